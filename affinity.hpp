@@ -0,0 +1,76 @@
+#ifndef AFFINITY_HPP
+#define AFFINITY_HPP
+
+#include <string>
+#include <sstream>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using std::string;
+using std::vector;
+
+// Highest cpu number a cpu set can hold
+#ifdef __linux__
+const unsigned long maxCpu = CPU_SETSIZE-1;
+#else
+const unsigned long maxCpu = 1023;
+#endif
+
+// Parses a cpu list like "0-7,16-23" (the format used by taskset and /sys/devices/system/node/node*/cpulist)
+bool parse_cpu_list(const string list, vector <unsigned> &cpus){
+	cpus.clear();
+	std::istringstream ranges(list);
+	string range;
+	try{
+		while (std::getline(ranges, range, ',')){
+			const size_t dash = range.find('-');
+			const unsigned long first = std::stoul(range.substr(0, dash));
+			const unsigned long last  = (dash == string::npos) ? first : std::stoul(range.substr(dash+1));
+			if ((last < first) || (last > maxCpu)) return false;
+			for (unsigned long cpu=first; cpu<=last; cpu++)
+				cpus.push_back(cpu);
+		}
+	} catch (const std::logic_error &){ // std::stoul() failed
+		return false;
+	}
+	return !cpus.empty();
+}
+
+// The cpus this process is allowed to run on
+vector <unsigned> get_available_cpus(){
+	vector <unsigned> cpus;
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0){
+		for (unsigned cpu=0; cpu<CPU_SETSIZE; cpu++)
+			if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+	}
+#endif
+	return cpus;
+}
+
+// Pins the calling thread to a group of cpus. Memory the thread touches first after this is allocated on their NUMA node,
+// and threads it starts afterwards inherit the same cpus
+bool pin_current_thread(const vector <unsigned> &cpus){
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (const unsigned cpu : cpus){
+		if (cpu >= CPU_SETSIZE) return false;
+		CPU_SET(cpu, &set);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	(void)cpus;
+	return false;
+#endif
+}
+
+bool pin_current_thread(const unsigned cpu){return pin_current_thread(vector <unsigned>{cpu});}
+
+#endif // AFFINITY_HPP
@@ -0,0 +1,176 @@
+#ifndef AUTOTUNE_HPP
+#define AUTOTUNE_HPP
+
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <chrono>
+#include <algorithm> // std::find()
+#include <cstdlib> // getenv()
+
+#include <unistd.h> // gethostname()
+
+#include "searchers.hpp"
+
+using std::string;
+using std::vector;
+
+struct TuneConfig{
+	unsigned numThreads=0;
+	unsigned stepThreads=1;
+	unsigned batchSize=0;
+	double soupsPerSecond=0;
+};
+
+// Benchmarks the thread count, stepping engine and batch size for one set of search parameters
+// and remembers the fastest one for this host in a cache file
+class Autotuner{
+	string ruleString;
+	unsigned nIters, soupSize, batchSize;
+	unsigned char soupPercentAlive;
+	bool quiet;
+	vector <unsigned> cpus; // Pinning used by the search, so it's benchmarked too
+
+	const double secondsPerConfig=0.3;
+	const unsigned hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	string get_cache_key(){
+		char hostname[256] = {};
+		gethostname(hostname, sizeof(hostname)-1);
+
+		const string rule = calib::Calib::rule_to_rulestring(calib::Calib::rulestring_to_rule(ruleString));
+		string key = string(hostname) + ';' + to_str(hardwareThreads) + ';' + rule + ';' + to_str(nIters) + ';' + to_str(soupSize) + ';' + to_str(unsigned(soupPercentAlive));
+
+		// Pinned and unpinned searches can have different best settings
+		if (!cpus.empty()){
+			key += ";cpus=";
+			for (unsigned i=0; i<cpus.size(); i++)
+				key += (i ? "," : "") + to_str(cpus[i]);
+		}
+		return key;
+	}
+
+	double benchmark(const TuneConfig config){
+		DeathSearcher searcher(ruleString, nIters, soupSize, config.batchSize, "", soupPercentAlive);
+		searcher.set_num_threads(config.numThreads);
+		searcher.set_step_threads(config.stepThreads);
+		searcher.set_cpus(cpus);
+
+		const auto start = std::chrono::steady_clock::now();
+		double elapsed=0;
+		unsigned long long soups=0;
+		while (elapsed < secondsPerConfig){
+			searcher.run_search_batch();
+			searcher.clear_result(); // The soups are random, so results found here aren't worth keeping
+			soups += config.batchSize;
+			elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+		return soups/elapsed;
+	}
+
+	// Benchmarks config and makes it the best one if it's faster
+	void try_config(TuneConfig config, TuneConfig &best){
+		config.soupsPerSecond = benchmark(config);
+		if (!quiet){
+			std::cout << "  threads=" << (config.numThreads ? to_str(config.numThreads) : "per soup")
+				<< " stepthreads=" << config.stepThreads << " batch=" << config.batchSize
+				<< ": " << unsigned(config.soupsPerSecond) << " soups/s\n";
+		}
+		if (config.soupsPerSecond > best.soupsPerSecond)
+			best = config;
+	}
+
+	TuneConfig tune(){
+		TuneConfig best;
+		const unsigned smallBatch = hardwareThreads*4;
+
+		// Thread count (0 is one thread per soup, the old default)
+		vector <unsigned> threadCounts{0};
+		for (unsigned numThreads : {1u, hardwareThreads/2, hardwareThreads, hardwareThreads*2}){
+			if (numThreads && (std::find(threadCounts.begin(), threadCounts.end(), numThreads) == threadCounts.end()))
+				threadCounts.push_back(numThreads);
+		}
+		for (unsigned numThreads : threadCounts){
+			TuneConfig config;
+			config.numThreads = numThreads;
+			config.batchSize = smallBatch;
+			try_config(config, best);
+		}
+
+		// Stepping engine, only worth it if there are spare cores for update_using_threads
+		for (unsigned stepThreads=2; stepThreads<=std::min(4u, hardwareThreads); stepThreads <<= 1){
+			TuneConfig config = best;
+			config.stepThreads = stepThreads;
+			try_config(config, best);
+		}
+
+		// Batch size. Batches that would take much longer than the others to benchmark are skipped
+		const unsigned workers = best.numThreads ? best.numThreads : hardwareThreads;
+		for (unsigned newBatchSize : {workers*16, workers*64, batchSize}){
+			if ((newBatchSize == best.batchSize) || (newBatchSize == 0)) continue;
+			if (newBatchSize / best.soupsPerSecond > secondsPerConfig*4) continue;
+
+			TuneConfig config = best;
+			config.batchSize = newBatchSize;
+			try_config(config, best);
+		}
+
+		return best;
+	}
+
+	bool load_cached(const string cacheFilename, TuneConfig &out){
+		std::ifstream cacheFile(cacheFilename);
+		const string key = get_cache_key();
+		bool found=false;
+
+		// Later lines replace earlier ones
+		string line;
+		while (std::getline(cacheFile, line)){
+			std::istringstream fields(line);
+			string lineKey;
+			TuneConfig config;
+			if ((fields >> lineKey >> config.numThreads >> config.stepThreads >> config.batchSize >> config.soupsPerSecond) && (lineKey == key) && config.batchSize){
+				out = config;
+				found = true;
+			}
+		}
+		return found;
+	}
+
+	void save_cached(const string cacheFilename, const TuneConfig config){
+		std::ofstream cacheFile(cacheFilename, std::ofstream::app);
+		cacheFile << get_cache_key() << ' ' << config.numThreads << ' ' << config.stepThreads << ' ' << config.batchSize << ' ' << config.soupsPerSecond << '\n';
+	}
+
+	public:
+
+	Autotuner(const string newRuleString, const unsigned newNIters, const unsigned newSoupSize, const unsigned newBatchSize, const unsigned char newSoupPercentAlive, const bool newQuiet){
+		ruleString=newRuleString; nIters=newNIters; soupSize=newSoupSize; batchSize=newBatchSize; soupPercentAlive=newSoupPercentAlive; quiet=newQuiet;
+	}
+
+	void set_cpus(const vector <unsigned> newCpus){cpus=newCpus;}
+
+	static string get_default_cache_filename(){
+		const char *home = getenv("HOME");
+		return home ? string(home) + "/.dsearch_autotune" : ".dsearch_autotune";
+	}
+
+	// Uses the cached result unless retune is set
+	TuneConfig get_config(const string cacheFilename, const bool retune){
+		TuneConfig config;
+		if (!retune && load_cached(cacheFilename, config)){
+			if (!quiet) std::cout << "Using autotuned settings from " << cacheFilename << '\n';
+			return config;
+		}
+
+		if (!quiet) std::cout << "Autotuning...\n";
+		config = tune();
+		save_cached(cacheFilename, config);
+		return config;
+	}
+};
+
+#endif // AUTOTUNE_HPP
@@ -8,6 +8,10 @@
 #include <vector>
 #include <thread>
 #include <functional>
+#include <algorithm> // std::min(), std::copy()
+#include <bitset>
+#include <cstdint>
+#include <cstdlib> // rand()
 
 using std::array;
 using std::vector;
@@ -43,36 +47,167 @@ namespace calib{
 		return convert.str();
 	}
 
+	typedef uint64_t wordType;
+	const unsigned bitsPerWord=64;
+
+	unsigned words_per_row(const unsigned width){return (width + bitsPerWord-1) / bitsPerWord;}
+
+	// Mask of the bits that are part of the grid in the last word of a row
+	wordType last_word_mask(const unsigned width){
+		return (width % bitsPerWord) ? (wordType(1) << (width % bitsPerWord)) - 1 : ~wordType(0);
+	}
+
+	// Clears n bits of a row, starting at bit x
+	void clear_row_bits(wordType *row, const unsigned x, const unsigned n){
+		for (unsigned bit=x; bit < x+n; ){
+			const unsigned shift = bit % bitsPerWord;
+			const unsigned count = std::min(bitsPerWord - shift, x+n - bit);
+			const wordType mask = (count == bitsPerWord) ? ~wordType(0) : ((wordType(1) << count) - 1) << shift;
+			row[bit / bitsPerWord] &= ~mask;
+			bit += count;
+		}
+	}
+
+	// ORs the first n bits of src into row, starting at bit x. The caller makes sure x+n fits in the row
+	void or_row_bits(const wordType *src, const unsigned n, wordType *row, const unsigned x){
+		const unsigned shift = x % bitsPerWord;
+		for (unsigned i=0; i < words_per_row(n); i++){
+			wordType word = src[i];
+			if ((i == words_per_row(n)-1)) word &= last_word_mask(n);
+
+			row[x/bitsPerWord + i] |= word << shift;
+			if (shift && (word >> (bitsPerWord - shift)))
+				row[x/bitsPerWord + i + 1] |= word >> (bitsPerWord - shift);
+		}
+	}
+
+	struct BoundingBox{
+		bool empty=true;
+		unsigned minX=0, minY=0, maxX=0, maxY=0; // Inclusive
+	};
+
+	// Read-only view of a grid's storage, nothing is copied
+	// Rows are stored one after another, wordsPerRow words each, and cell x,y is bit x%64 of word x/64 of row y.
+	// Bits past the width in a row's last word are always 0
+	struct GridView{
+		const wordType *words=nullptr;
+		unsigned width=0, height=0, wordsPerRow=0;
+
+		const wordType *get_row(const unsigned y) const {return words + (unsigned long)y*wordsPerRow;}
+		wordType get_word(const unsigned wordX, const unsigned y) const {return get_row(y)[wordX];}
+		bool get_state(const unsigned x, const unsigned y) const {return (get_row(y)[x / bitsPerWord] >> (x % bitsPerWord)) & 1;}
+
+		unsigned long long get_population() const {
+			unsigned long long sum=0;
+			for (unsigned long i=0; i < (unsigned long)height*wordsPerRow; i++)
+				sum += std::bitset<64>(words[i]).count();
+			return sum;
+		}
+
+		BoundingBox get_bounding_box() const {
+			BoundingBox box;
+			for (unsigned y=0; y<height; y++){
+				const wordType *row = get_row(y);
+				for (unsigned wordX=0; wordX<wordsPerRow; wordX++){
+					if (!row[wordX]) continue;
+					const unsigned firstX = wordX*bitsPerWord + __builtin_ctzll(row[wordX]);
+					const unsigned lastX  = wordX*bitsPerWord + bitsPerWord-1 - __builtin_clzll(row[wordX]);
+					if (box.empty){
+						box.empty=false;
+						box.minX=firstX; box.maxX=lastX; box.minY=y;
+					}
+					box.minX = std::min(box.minX, firstX);
+					box.maxX = std::max(box.maxX, lastX);
+					box.maxY = y;
+				}
+			}
+			return box;
+		}
+	};
+
 	class Calib{
 		// cgol rule
 		//                   0 1 2 3 4 5 6 7 8
 		ruleType   birthRule{0,0,0,1,0,0,0,0,0};
 		ruleType surviveRule{0,0,1,1,0,0,0,0,0};
-		unsigned numThreads=1, width=0, height=0;
-		gridType grid;
-		gridType tmpGrid;
+		unsigned numThreads=1, width=0, height=0, wordsPerRow=0;
+
+		// Packed row by row, see GridView
+		vector <wordType> grid;
+		vector <wordType> tmpGrid;
+
+		// Dirty tiles, one word wide and tileHeight rows tall. A tile is only recomputed if it or a neighboring tile changed
+		// in the last generation, or since the one before that (then tmpGrid already holds its next state, which skips period 2 ash)
+		static const unsigned tileHeight=32;
+		unsigned tilesX=0, tilesY=0;
+		vector <unsigned char> tileChanged, tileChanged2; // Since the last generation, since the one before that
+		vector <unsigned char> newTileChanged, newTileChanged2;
+		bool tilesValid=false; // tmpGrid holds the last generation and the flags are up to date. Anything that edits the grid clears it
 
 		// These are relative positions that make up the neighborhood.
 		neighborhoodType neighborhood{{-1,-1}, {0,-1}, {1,-1}, {-1,0}, {1,0}, {-1,1}, {0,1}, {1,1}}; // Moore
 
-		void resize_grids(){
-			if ((width==0) || (height==0)){
-				std::cerr << "Grid width or height can't be 0 (width=" << width << ",height=" << height << ")\n";
+		wordType *get_row(const unsigned y){return &grid[(unsigned long)y*wordsPerRow];}
+
+		void set_bit(vector <wordType> &bits, const unsigned x, const unsigned y, const bool state){
+			const wordType mask = wordType(1) << (x % bitsPerWord);
+			wordType &word = bits[(unsigned long)y*wordsPerRow + x/bitsPerWord];
+			word = state ? (word | mask) : (word & ~mask);
+		}
+
+		// Keeps the cells that still fit
+		void resize_grids(const unsigned newWidth, const unsigned newHeight){
+			if ((newWidth==0) || (newHeight==0)){
+				std::cerr << "Grid width or height can't be 0 (width=" << newWidth << ",height=" << newHeight << ")\n";
 				return;
 			}
 
-			grid.resize(width);
-			grid.shrink_to_fit();
-			for (unsigned i=0; i<grid.size(); i++){
-				grid[i].resize(height);
-				grid[i].shrink_to_fit();
+			const GridView oldView = view();
+			vector <wordType> newGrid((unsigned long)newHeight*words_per_row(newWidth), 0);
+			for (unsigned y=0; y < std::min(newHeight, oldView.height); y++)
+				or_row_bits(oldView.get_row(y), std::min(newWidth, oldView.width), &newGrid[(unsigned long)y*words_per_row(newWidth)], 0);
+
+			grid.swap(newGrid);
+			width=newWidth; height=newHeight;
+			wordsPerRow = words_per_row(width);
+			tmpGrid.assign(grid.size(), 0);
+			tilesValid=false;
+		}
+
+		void prepare_tmp_grid(){
+			if (tmpGrid.size() != grid.size()) // The grid was resized since the last update
+				tmpGrid.assign(grid.size(), 0);
+
+			if (!tilesValid){ // Recompute every tile once
+				tilesX = wordsPerRow;
+				tilesY = (height + tileHeight-1) / tileHeight;
+				tileChanged.assign((unsigned long)tilesX*tilesY, 1);
+				tileChanged2.assign(tileChanged.size(), 1);
+				newTileChanged.resize(tileChanged.size());
+				newTileChanged2.resize(tileChanged.size());
+			}
+		}
+
+		void finish_update(){
+			grid.swap(tmpGrid);
+			tileChanged.swap(newTileChanged);
+			tileChanged2.swap(newTileChanged2);
+			tilesValid=true;
+		}
+
+		// True if none of the 3x3 tiles around tileX,tileY (wrapping) are set in flags
+		bool tiles_quiet(const vector <unsigned char> &flags, const unsigned tileX, const unsigned tileY) const {
+			for (unsigned dy=0; dy<3; dy++){
+				const unsigned long rowIndex = (unsigned long)((tileY + tilesY + dy-1) % tilesY)*tilesX;
+				for (unsigned dx=0; dx<3; dx++)
+					if (flags[rowIndex + (tileX + tilesX + dx-1) % tilesX]) return false;
 			}
+			return true;
+		}
 
-			// Maybe faster
-			tmpGrid=grid;
-			tmpGrid.shrink_to_fit();
-			for (unsigned i=0; i<tmpGrid.size(); i++)
-				tmpGrid[i].shrink_to_fit();
+		bool next_state(const unsigned x, const unsigned y){
+			const unsigned numNeighbors = get_num_neighbors_of_state(x,y,1);
+			return get_state(x,y) ? surviveRule[numNeighbors] : birthRule[numNeighbors];
 		}
 
 		public:
@@ -86,40 +221,95 @@ namespace calib{
 
 		// Get, set
 		std::pair <ruleType,ruleType> get_rule(){return std::make_pair(birthRule,surviveRule);}
-		void set_rule(const std::pair <ruleType,ruleType> newRule){birthRule=newRule.first; surviveRule=newRule.second;}
-
-		void set_size(const unsigned newWidth, const unsigned newHeight){width=newWidth; height=newHeight; resize_grids();}
-		array <unsigned long, 2> get_size(){return {grid.size(), grid[0].size()};} // Unsigned long so the compiler doesn't complain about using just an unsigned
-		unsigned long get_width(){return grid.size();}
-		unsigned long get_height(){return grid[0].size();}
-		bool get_state(const unsigned x, const unsigned y) {return grid[x][y];}
-		void set_state(const unsigned x, const unsigned y, const bool state) {grid[x][y] = state;}
-		gridType get_grid() {return grid;}
-		void set_grid(const gridType newGrid) {grid = newGrid;}
+		void set_rule(const std::pair <ruleType,ruleType> newRule){birthRule=newRule.first; surviveRule=newRule.second; tilesValid=false;}
+
+		void set_size(const unsigned newWidth, const unsigned newHeight){resize_grids(newWidth, newHeight);}
+		array <unsigned long, 2> get_size(){return {width, height};} // Unsigned long so the compiler doesn't complain about using just an unsigned
+		unsigned long get_width(){return width;}
+		unsigned long get_height(){return height;}
+		bool get_state(const unsigned x, const unsigned y) const {return (grid[(unsigned long)y*wordsPerRow + x/bitsPerWord] >> (x % bitsPerWord)) & 1;}
+		void set_state(const unsigned x, const unsigned y, const bool state) {set_bit(grid, x, y, state); tilesValid=false;}
 		unsigned get_num_threads(){return numThreads;}
 		void set_num_threads(const unsigned newNumThreads){numThreads = newNumThreads;}
 
-		void add_size_all_sides(const unsigned size=1){
-			for (unsigned i=0; i<grid.size(); i++){
-				grid[i].insert(grid[i].begin(),size,0);
-				grid[i].insert(grid[i].end(),  size,0);
+		// Copies, for code that wants the old grid[x][y] layout. view() doesn't copy anything
+		gridType get_grid(){
+			gridType out(width, vector <bool>(height));
+			for (unsigned y=0; y<height; y++)
+				for (unsigned x=0; x<width; x++)
+					out[x][y] = get_state(x,y);
+			return out;
+		}
+		void set_grid(const gridType &newGrid){
+			set_size(newGrid.size(), newGrid[0].size());
+			for (unsigned y=0; y<height; y++)
+				for (unsigned x=0; x<width; x++)
+					set_state(x,y, newGrid[x][y]);
+		}
+
+		GridView view() const {
+			GridView out;
+			out.words=grid.data(); out.width=width; out.height=height; out.wordsPerRow=wordsPerRow;
+			return out;
+		}
+
+		// Copies the grid into a packed buffer laid out like GridView, with stride words per row (at least wordsPerRow)
+		void store_bits(wordType *out, const unsigned stride) const {
+			for (unsigned y=0; y<height; y++){
+				std::copy(grid.begin() + (unsigned long)y*wordsPerRow, grid.begin() + (unsigned long)(y+1)*wordsPerRow, out + (unsigned long)y*stride);
+				std::fill(out + (unsigned long)y*stride + wordsPerRow, out + (unsigned long)(y+1)*stride, 0);
+			}
+		}
+
+		// Resizes the grid to newWidth x newHeight and copies a packed buffer (with stride words per row) into it
+		void load_bits(const wordType *bits, const unsigned newWidth, const unsigned newHeight, const unsigned stride){
+			if ((newWidth != width) || (newHeight != height)){
+				width=newWidth; height=newHeight;
+				grid.assign((unsigned long)height*words_per_row(width), 0);
+				wordsPerRow = words_per_row(width);
+				tmpGrid.assign(grid.size(), 0);
+			}
+			for (unsigned y=0; y<height; y++){
+				wordType *row = get_row(y);
+				std::copy(bits + (unsigned long)y*stride, bits + (unsigned long)y*stride + wordsPerRow, row);
+				row[wordsPerRow-1] &= last_word_mask(width);
+			}
+			tilesValid=false;
+		}
+
+		// Overwrites the bitsWidth x bitsHeight area at offsetX,offsetY with a packed buffer, the rest of the grid is kept
+		void draw_bits_to_grid(const wordType *bits, const unsigned bitsWidth, const unsigned bitsHeight, const unsigned stride, const unsigned offsetX, const unsigned offsetY){
+			if ((offsetX >= width) || (offsetY >= height)) return;
+			const unsigned clippedWidth = std::min(bitsWidth, width-offsetX);
+			for (unsigned y=0; y < bitsHeight && offsetY+y < height; y++){
+				wordType *row = get_row(offsetY+y);
+				clear_row_bits(row, offsetX, clippedWidth);
+				or_row_bits(bits + (unsigned long)y*stride, clippedWidth, row, offsetX);
 			}
+			tilesValid=false;
+		}
 
-			const vector <bool> emptyRow(grid.size() + (size << 1), 0);
-			grid.insert(grid.begin(),size,emptyRow);
-			grid.insert(grid.end(),  size,emptyRow);
+		void add_size_all_sides(const unsigned size=1){
+			const GridView oldView = view();
+			const unsigned newWidth = width + (size << 1);
+			vector <wordType> newGrid((unsigned long)(height + (size << 1))*words_per_row(newWidth), 0);
+			for (unsigned y=0; y<height; y++)
+				or_row_bits(oldView.get_row(y), width, &newGrid[(unsigned long)(y+size)*words_per_row(newWidth)], size);
 
+			grid.swap(newGrid);
 			width  += size<<1;
 			height += size<<1;
+			wordsPerRow = words_per_row(width);
+			tilesValid=false;
 		}
 
 		unsigned get_num_neighbors_of_state(const unsigned x, const unsigned y, const bool state){
 			unsigned sum=0;
 			for (array <int, 2> relativeNeighborPos : neighborhood){
-				unsigned newX=modulo(int(x)+relativeNeighborPos[0], grid.size());
-				unsigned newY=modulo(int(y)+relativeNeighborPos[1], grid[0].size());
+				unsigned newX=modulo(int(x)+relativeNeighborPos[0], width);
+				unsigned newY=modulo(int(y)+relativeNeighborPos[1], height);
 
-				sum += grid[newX][newY] == state;
+				sum += get_state(newX,newY) == state;
 			}
 			return sum;
 		}
@@ -128,8 +318,8 @@ namespace calib{
 			// TODO Use array with fixed size to improve speed
 			vector <array <unsigned, 2>> out;
 			for (array <int, 2> relativeNeighborPos : neighborhood){
-				unsigned newX=modulo(int(x)+relativeNeighborPos[0], grid.size());
-				unsigned newY=modulo(int(y)+relativeNeighborPos[1], grid[0].size());
+				unsigned newX=modulo(int(x)+relativeNeighborPos[0], width);
+				unsigned newY=modulo(int(y)+relativeNeighborPos[1], height);
 				out.push_back({newX, newY});
 			}
 			return out;
@@ -137,53 +327,69 @@ namespace calib{
 
 		unsigned update(const bool doSum=false){
 			unsigned sum=0;
-			gridType newGrid=grid;
-
-			for (unsigned y=0; y < grid[0].size(); y++){
-				for (unsigned x=0; x < grid.size(); x++){
-					unsigned numNeighbors = get_num_neighbors_of_state(x,y,1);
-					if (!grid[x][y])
-						newGrid[x][y] = birthRule[numNeighbors];
-					else
-						newGrid[x][y] = surviveRule[numNeighbors];
-
-					if (doSum) sum += newGrid[x][y];
-				}
-			}
-			grid=newGrid;
+			prepare_tmp_grid();
+			update_section(0, 1, sum, doSum);
+			finish_update();
 			return sum;
 		}
 
 		unsigned update_using_threads(const bool doSum=false){
+			prepare_tmp_grid();
 			vector <unsigned> sectionSums(numThreads, 0);
 			vector <std::thread> sectionThreads(numThreads);
 
 			for (unsigned sectionIndex=0; sectionIndex < numThreads; sectionIndex++)
-				sectionThreads[sectionIndex] = std::thread(&Calib::update_section, this, sectionIndex, std::ref(sectionSums[sectionIndex]), doSum);
+				sectionThreads[sectionIndex] = std::thread(&Calib::update_section, this, sectionIndex, numThreads, std::ref(sectionSums[sectionIndex]), doSum);
 
 			for (std::thread &thread : sectionThreads)
 				thread.join();
 
-			grid = tmpGrid;
+			finish_update();
 			unsigned fullSum=0;
 			for (unsigned sum : sectionSums) fullSum += sum;
 			return fullSum;
 		}
 
-		unsigned update_section(const unsigned sectionIndex, unsigned &sum, const bool doSum){
-			// TODO Make this better so that the grid width doesn't have to be divisible by numThreads
-			const unsigned sectionXStart = sectionIndex * (grid.size()/numThreads);
-			const unsigned sectionXEnd   = sectionXStart + (grid.size()/numThreads);
-
-			for (unsigned y=0; y < grid[0].size(); y++){
-				for (unsigned x=sectionXStart; x < sectionXEnd; x++){
-					unsigned numNeighbors = get_num_neighbors_of_state(x,y,1);
-					if (!grid[x][y])
-						tmpGrid[x][y] = birthRule[numNeighbors];
-					else
-						tmpGrid[x][y] = surviveRule[numNeighbors];
-
-					if (doSum) sum += tmpGrid[x][y];
+		// Sections are bands of tile rows, so no two threads ever write to the same word or tile. Call prepare_tmp_grid() first
+		unsigned update_section(const unsigned sectionIndex, const unsigned numSections, unsigned &sum, const bool doSum){
+			// The last sections get one tile row more when tilesY isn't divisible by numSections
+			const unsigned sectionTileYStart = (unsigned long long)sectionIndex     * tilesY / numSections;
+			const unsigned sectionTileYEnd   = (unsigned long long)(sectionIndex+1) * tilesY / numSections;
+
+			for (unsigned tileY=sectionTileYStart; tileY < sectionTileYEnd; tileY++){
+				const unsigned yStart = tileY*tileHeight;
+				const unsigned yEnd   = std::min(height, yStart + unsigned(tileHeight));
+
+				for (unsigned tileX=0; tileX < tilesX; tileX++){
+					const unsigned long tile = (unsigned long)tileY*tilesX + tileX;
+
+					if (tiles_quiet(tileChanged, tileX, tileY)){ // Still life here, tmpGrid already holds the same cells
+						newTileChanged[tile]=0;
+						newTileChanged2[tile]=0;
+					} else if (tiles_quiet(tileChanged2, tileX, tileY)){ // Back where it was two generations ago, so the next generation is in tmpGrid
+						newTileChanged[tile]=tileChanged[tile];
+						newTileChanged2[tile]=0;
+					} else {
+						const unsigned wordWidth = std::min(bitsPerWord, width - tileX*bitsPerWord);
+						bool changed=false, changed2=false;
+						for (unsigned y=yStart; y < yEnd; y++){
+							wordType newWord=0;
+							for (unsigned bit=0; bit < wordWidth; bit++)
+								newWord |= wordType(next_state(tileX*bitsPerWord + bit, y)) << bit;
+
+							wordType &tmpWord = tmpGrid[(unsigned long)y*wordsPerRow + tileX];
+							changed  |= newWord != grid[(unsigned long)y*wordsPerRow + tileX];
+							changed2 |= newWord != tmpWord;
+							tmpWord = newWord;
+						}
+						newTileChanged[tile]  = changed;
+						newTileChanged2[tile] = changed2 || !tilesValid; // tmpGrid didn't hold a generation yet
+					}
+
+					if (doSum){
+						for (unsigned y=yStart; y < yEnd; y++)
+							sum += std::bitset<64>(tmpGrid[(unsigned long)y*wordsPerRow + tileX]).count();
+					}
 				}
 			}
 			return sum;
@@ -192,15 +398,12 @@ namespace calib{
 		unsigned update_naively(const bool doSum=false){
 			unsigned sum=0;
 
-			for (unsigned y=0; y < grid[0].size(); y++){
-				for (unsigned x=0; x < grid.size(); x++){
-					unsigned numNeighbors = get_num_neighbors_of_state(x,y,1);
-					if (!grid[x][y])
-						grid[x][y] = birthRule[numNeighbors];
-					else
-						grid[x][y] = surviveRule[numNeighbors];
+			for (unsigned y=0; y < height; y++){
+				for (unsigned x=0; x < width; x++){
+					const bool newState = next_state(x,y);
+					set_state(x,y, newState); // Also makes the next update() recompute every tile
 
-					if (doSum) sum += grid[x][y];
+					if (doSum) sum += newState;
 				}
 			}
 
@@ -208,24 +411,26 @@ namespace calib{
 		}
 
 		void fill_grid(const bool state){
-			for (unsigned y=0; y < grid[0].size(); y++){
-				for (unsigned x=0; x < grid.size(); x++)
-					grid[x][y] = state;
+			std::fill(grid.begin(), grid.end(), state ? ~wordType(0) : 0);
+			if (state){
+				for (unsigned y=0; y < height; y++)
+					get_row(y)[wordsPerRow-1] &= last_word_mask(width);
 			}
+			tilesValid=false;
 		}
 
 		void fill_grid_randomly(){
-			for (unsigned y=0; y<grid[0].size(); y++){
-				for (unsigned x=0; x<grid.size(); x++){
+			for (unsigned y=0; y<height; y++){
+				for (unsigned x=0; x<width; x++){
 					if (rand()&1)
-						grid[x][y]=1;
+						set_state(x,y,1);
 				}
 			}
 		}
 
-		void draw_object_to_grid(const Object obj, const unsigned offsetX, const unsigned offsetY){
-			for (Position pos : obj)
-				grid[pos[0] + offsetX][pos[1] + offsetY] = 1;
+		void draw_object_to_grid(const Object &obj, const unsigned offsetX, const unsigned offsetY){
+			for (const Position &pos : obj)
+				set_state(pos[0] + offsetX, pos[1] + offsetY, 1);
 		}
 
 		// EXPERIMENTAL (object finding function)
@@ -239,7 +444,7 @@ namespace calib{
 					if (value_in_vector(neighborPos, out)) // Cell is already in the object
 						continue;
 
-					if (grid[neighborPos[0]][neighborPos[1]])
+					if (get_state(neighborPos[0], neighborPos[1]))
 						out.push_back(neighborPos); // Add cell to object
 				}
 			}
@@ -252,11 +457,11 @@ namespace calib{
 			return out;
 		}
 
-		static string object_to_rle_object(const Object obj, const unsigned x, const unsigned y){
+		static string object_to_rle_object(const Object &obj, const unsigned x, const unsigned y){
 			string out="";
 			vector <string> rows(y, str_n_times("b",x)); // b signifies an empty cell
 
-			for (Position pos : obj)
+			for (const Position &pos : obj)
 				rows[pos[1]][pos[0]] = 'o'; // o Signifies an alive cell
 
 			for (string row : rows)
@@ -265,12 +470,15 @@ namespace calib{
 			return out+'!'; // ! Signifies the end of the pattern
 		}
 
-		static string object_to_rle(const Object obj, const std::pair <ruleType,ruleType> rule, const unsigned x, const unsigned y){
+		static string object_to_rle(const Object &obj, const std::pair <ruleType,ruleType> rule, const unsigned x, const unsigned y){
 			string out = "x=" + to_str(x) + ",y=" + to_str(y) + ",rule=" + rule_to_rulestring(rule) + "\n";
 			out += object_to_rle_object(obj, x, y);
 			return out;
 		}
 
+		// Reads the first pattern in rle (the header line is optional)
+		static Object rle_to_object(const string rle);
+
 		static string rule_to_rulestring(const std::pair <ruleType,ruleType> rule){
 			if ((rule.first.size()>10) || (rule.second.size()>10)) // Rule has a digit above 9, impossible to fit within one character
 				return "INVALID";
@@ -320,6 +528,126 @@ namespace calib{
 			return std::make_pair(outBirthRule,outSurviveRule);
 		}
 	};
+
+	struct RlePattern{
+		unsigned width=0, height=0; // From the header, 0 if there wasn't one or it isn't a number
+		string rule;                // From the header, empty if there wasn't one
+		Object cells;
+		vector <string> comments;   // '#' lines before the header and between the '!' and the next empty line
+	};
+
+	// Reads patterns one at a time from a stream, so files of any size can be read without loading them
+	// Patterns end at '!', and the body can be split over any number of lines
+	class RleReader{
+		std::istream &in;
+		string line;
+		bool hasPendingLine=false; // line was read but belongs to the next pattern
+
+		bool next_line(){
+			if (hasPendingLine){
+				hasPendingLine=false;
+				return true;
+			}
+			if (!std::getline(in, line)) return false;
+			if (!line.empty() && (line.back() == '\r')) line.pop_back();
+			return true;
+		}
+
+		static string trim(const string str){
+			const size_t first = str.find_first_not_of(" \t");
+			if (first == string::npos) return "";
+			return str.substr(first, str.find_last_not_of(" \t") - first + 1);
+		}
+
+		// x = 16, y = 16, rule = B3/S23
+		static void parse_header(const string header, RlePattern &out){
+			std::istringstream fields(header);
+			string field;
+			while (std::getline(fields, field, ',')){
+				const size_t equals = field.find('=');
+				if (equals == string::npos) continue;
+				const string key   = trim(field.substr(0, equals));
+				const string value = trim(field.substr(equals+1));
+
+				try{
+					if (key == "x") out.width = std::stoul(value);
+					else if (key == "y") out.height = std::stoul(value);
+				} catch (const std::logic_error &){ // std::stoul() failed, the caller sees a size of 0
+					if (key == "x") out.width = 0;
+					else out.height = 0;
+				}
+				if (key == "rule") out.rule = value;
+			}
+		}
+
+		public:
+
+		RleReader(std::istream &newIn) : in(newIn) {}
+
+		// Returns false when there are no patterns left
+		bool next(RlePattern &out){
+			out = RlePattern();
+			unsigned x=0, y=0, runCount=0;
+			bool inBody=false;
+
+			while (next_line()){
+				const size_t first = line.find_first_not_of(" \t");
+				if (first == string::npos) continue; // Empty lines between patterns
+				if (line[first] == '#'){
+					out.comments.push_back(line);
+					continue;
+				}
+				if (!inBody && (line[first] == 'x')){
+					parse_header(line, out);
+					inBody=true;
+					continue;
+				}
+
+				inBody=true;
+				for (unsigned i=first; i<line.size(); i++){
+					const char chr = line[i];
+					if (Calib::is_digit(chr)){
+						runCount = runCount*10 + (chr-'0');
+						continue;
+					}
+
+					const unsigned run = runCount ? runCount : 1;
+					runCount=0;
+					if ((chr == 'b') || (chr == '.')){ // Dead cells
+						x += run;
+					} else if (chr == '$'){ // New line(s)
+						y += run;
+						x = 0;
+					} else if (chr == '!'){ // End of the pattern
+						// Comments up to the next empty line belong to this pattern (dsearch puts its metadata there)
+						while (next_line()){
+							if (trim(line).empty()) break;
+							if (line[line.find_first_not_of(" \t")] != '#'){
+								hasPendingLine=true;
+								break;
+							}
+							out.comments.push_back(line);
+						}
+						return true;
+					} else if ((chr >= 'A') && (chr <= 'z')){ // 'o', or any state of a multistate rule
+						for (unsigned j=0; j<run; j++)
+							out.cells.push_back({x+j, y});
+						x += run;
+					}
+				}
+			}
+
+			return inBody; // A pattern missing its '!' still counts
+		}
+	};
+
+	inline Object Calib::rle_to_object(const string rle){
+		std::istringstream in(rle);
+		RleReader reader(in);
+		RlePattern pattern;
+		reader.next(pattern);
+		return pattern.cells;
+	}
 }
 
 #endif // CALIB_HPP
@@ -1,13 +1,17 @@
 #include <SFML/Graphics.hpp>
 #include <iostream>
 #include <cstdlib>
+#include <string>
 #include <array>
 #include <vector>
+#include <algorithm> // std::max()
 
 #include "calib.hpp"
+#include "simulation.hpp"
 
 using std::array;
 using std::vector;
+using std::string;
 
 const sf::Color bgColor{0,0,0};
 const sf::Color cellColor{255,255,255};
@@ -15,33 +19,84 @@ const sf::Color objectColor{255,0,0};
 
 const unsigned width=200, height=200;
 
-typedef vector <vector <bool>> gridType;
-
 void usage(){
 	std::cerr << "Usage: gui [number of threads]\n";
 }
 
-void draw_pxl(const unsigned x, const unsigned y, sf::RenderWindow &window, const sf::Color color){
-	sf::Texture pxlTxt;
-	pxlTxt.loadFromFile("pixel.png");
-	sf::Sprite pxlSpr;
-	pxlSpr.setTexture(pxlTxt);
-	pxlSpr.setPosition(x,y);
-	pxlSpr.setColor(color);
+// Keeps one texture with a pixel per cell, and only uploads the rows that changed since the last frame
+class GridRenderer{
+	sf::Texture texture;
+	sf::Sprite sprite;
+	vector <sf::Uint8> pixels; // RGBA
+	vector <calib::wordType> shownWords; // The grid the texture currently shows, laid out like GridView
+	unsigned width=0, height=0, wordsPerRow=0;
+	bool shownAny=false;
+
+	void set_pixel(const unsigned x, const unsigned y, const sf::Color color){
+		sf::Uint8 *pixel = &pixels[(x + y*width)*4];
+		pixel[0]=color.r; pixel[1]=color.g; pixel[2]=color.b; pixel[3]=color.a;
+	}
 
-	window.draw(pxlSpr);
-}
+	void resize(const calib::GridView &grid){
+		width=grid.width; height=grid.height; wordsPerRow=grid.wordsPerRow;
+		texture.create(width, height);
+		sprite.setTexture(texture, true);
+		pixels.assign(width*height*4, 0);
+		shownWords.assign(height*wordsPerRow, 0);
+		shownAny=false; // Every row gets uploaded
+	}
 
-// Very slow
-void draw_grid_to_window(sf::RenderWindow &window, calib::Calib &ca){
-	window.clear(bgColor); // This function only draws the alive cells
-	const array <unsigned long, 2> gridSize = ca.get_size();
-	for (unsigned y=0; y<gridSize[1]; y++){
-		for (unsigned x=0; x<gridSize[0]; x++){
-			if (ca.get_state(x,y))
-				draw_pxl(x,y, window, cellColor);
+	public:
+
+	void draw(sf::RenderWindow &window, const calib::GridView &grid){
+		if ((grid.width != width) || (grid.height != height))
+			resize(grid);
+
+		// Rows are compared a word at a time, and consecutive changed rows are uploaded together
+		unsigned firstChangedRow=0, numChangedRows=0;
+		for (unsigned y=0; y<height; y++){
+			const calib::wordType *row = grid.get_row(y);
+			calib::wordType *shownRow = &shownWords[y*wordsPerRow];
+
+			bool rowChanged=!shownAny;
+			for (unsigned wordX=0; wordX<wordsPerRow; wordX++){
+				const calib::wordType changed = shownAny ? row[wordX] ^ shownRow[wordX] : ~calib::wordType(0);
+				if (!changed) continue;
+
+				for (unsigned bit=0; bit<calib::bitsPerWord && wordX*calib::bitsPerWord + bit < width; bit++){
+					if ((changed >> bit) & 1)
+						set_pixel(wordX*calib::bitsPerWord + bit, y, ((row[wordX] >> bit) & 1) ? cellColor : bgColor);
+				}
+				shownRow[wordX] = row[wordX];
+				rowChanged=true;
+			}
+
+			if (rowChanged){
+				if (!numChangedRows) firstChangedRow=y;
+				++numChangedRows;
+			}
+			if (numChangedRows && (!rowChanged || (y == height-1))){
+				texture.update(&pixels[firstChangedRow*width*4], width, numChangedRows, 0, firstChangedRow);
+				numChangedRows=0;
+			}
 		}
+		shownAny=true;
+
+		window.draw(sprite);
+	}
+};
+
+// Object highlighting is drawn on top of the grid as one quad per cell
+void draw_object_overlay(sf::RenderWindow &window, const Object &objectCells){
+	sf::VertexArray quads(sf::Quads, objectCells.size()*4);
+	for (unsigned i=0; i<objectCells.size(); i++){
+		const float x=objectCells[i][0], y=objectCells[i][1];
+		quads[i*4  ] = sf::Vertex(sf::Vector2f(x,  y  ), objectColor);
+		quads[i*4+1] = sf::Vertex(sf::Vector2f(x+1,y  ), objectColor);
+		quads[i*4+2] = sf::Vertex(sf::Vector2f(x+1,y+1), objectColor);
+		quads[i*4+3] = sf::Vertex(sf::Vector2f(x,  y+1), objectColor);
 	}
+	window.draw(quads);
 }
 
 // For not crashing when clicking outside of the window
@@ -63,8 +118,6 @@ int main(int argc, char *argv[]){
 			usage();
 			numThreads = 1;
 		}
-		if (gridSize[0] % numThreads != 0)
-			std::cout << "WARNING: Width is not divisible by number of threads. Output will be wrong\n";
 		ca.set_num_threads(numThreads);
 	} else {
 		usage();
@@ -84,12 +137,42 @@ int main(int argc, char *argv[]){
 	window.setView(view);
 	window.setActive(true);
 
-	unsigned i=0;
+	window.setFramerateLimit(60);
+
+	// The grid is stepped on its own thread, the window just shows the newest snapshot of it
+	calib::SimulationThread sim(ca);
+	sim.start();
+	const calib::GridSnapshot *shown=nullptr;
+	string title;
+	calib::Calib objectFinder; // Finds objects in the shown snapshot, since ca belongs to the simulation thread
+
+	GridRenderer renderer;
 	while (window.isOpen()){
 		sf::Event e;
 		while (window.pollEvent(e)){
 			if (e.type == sf::Event::Closed)
 				window.close();
+
+			if (e.type == sf::Event::KeyPressed){
+				// Press Space to start/stop iterating the grid (hold shift when starting if you want to iterate using naivelife)
+				if (e.key.code == sf::Keyboard::Space){
+					if (sim.is_paused()){
+						sim.set_naive(sf::Keyboard::isKeyPressed(sf::Keyboard::LShift));
+						sim.run_forever();
+					} else {
+						sim.set_paused(true);
+					}
+				}
+
+				// '-' and '+' halve and double the generations per second, '0' removes the limit
+				const unsigned rate = sim.get_target_rate();
+				if (e.key.code == sf::Keyboard::Subtract || e.key.code == sf::Keyboard::Hyphen)
+					sim.set_target_rate(rate ? std::max(1u, rate/2) : 64);
+				else if (e.key.code == sf::Keyboard::Add || e.key.code == sf::Keyboard::Equal)
+					sim.set_target_rate((rate && rate < 1u<<16) ? rate*2 : 0);
+				else if (e.key.code == sf::Keyboard::Num0)
+					sim.set_target_rate(0);
+			}
 		}
 
 		// Draw with the mouse
@@ -97,47 +180,49 @@ int main(int argc, char *argv[]){
 			auto mousePos = sf::Mouse::getPosition(window);
 			auto worldPos = window.mapPixelToCoords(mousePos);
 
-			if (mousePosInView(mousePos, view))
-				ca.set_state(worldPos.x, worldPos.y, 1);
+			if (mousePosInView(mousePos, view)){
+				const unsigned x=worldPos.x, y=worldPos.y;
+				sim.post([x,y](calib::Calib &ca){ca.set_state(x,y,1);});
+			}
 		} else if (sf::Mouse::isButtonPressed(sf::Mouse::Right)){
 			auto mousePos = sf::Mouse::getPosition(window);
 			auto worldPos = window.mapPixelToCoords(mousePos);
 
-			if (mousePosInView(mousePos, view))
-				ca.set_state(worldPos.x, worldPos.y, 0);
+			if (mousePosInView(mousePos, view)){
+				const unsigned x=worldPos.x, y=worldPos.y;
+				sim.post([x,y](calib::Calib &ca){ca.set_state(x,y,0);});
+			}
 		}
 
 		// Click 'R' to fill the grid randomly
 		if (sf::Keyboard::isKeyPressed(sf::Keyboard::R))
-			ca.fill_grid_randomly();
-
+			sim.post([](calib::Calib &ca){ca.fill_grid_randomly();});
 
-		// Press Space to iterate the grid (hold shift if you want to iterate using naivelife)
-		if (sf::Keyboard::isKeyPressed(sf::Keyboard::Space)){
-			++i;
-			if (sf::Keyboard::isKeyPressed(sf::Keyboard::LShift))
-				ca.update_naively(); // This approach of updating won't work with threading
-			else
-				ca.update_using_threads(); // Alternatively, use ca.update();
+		const calib::GridSnapshot *latest = sim.get_latest_snapshot();
+		if (latest) shown = latest;
+		if (!shown) continue; // The simulation hasn't published anything yet
 
-			std::cout << i << '\n';
+		const string newTitle = "calib - generation " + calib::to_str(shown->generation) + (sim.is_paused() ? " (paused)" : "");
+		if (newTitle != title){
+			title = newTitle;
+			window.setTitle(title);
 		}
 
-		// Uncomment this line to only draw every 50 iterations. Change 50 to whatever you want
-//		if (i % 50 == 0)
-		{
-			draw_grid_to_window(window, ca);
+		window.clear(bgColor);
+		renderer.draw(window, shown->view());
 
-			// EXPERIMENTAL (Click 'O' to highlight objects)
-			if (sf::Keyboard::isKeyPressed(sf::Keyboard::O)){
-				auto mousePos = sf::Mouse::getPosition(window);
-				auto worldPos = window.mapPixelToCoords(mousePos);
+		// EXPERIMENTAL (Click 'O' to highlight objects)
+		if (sf::Keyboard::isKeyPressed(sf::Keyboard::O)){
+			auto mousePos = sf::Mouse::getPosition(window);
+			auto worldPos = window.mapPixelToCoords(mousePos);
 
-				auto objectCells = ca.get_object_cells(worldPos.x, worldPos.y);
-				for (auto cell : objectCells)
-					draw_pxl(cell[0], cell[1], window, objectColor);
+			if (mousePosInView(mousePos, view)){
+				objectFinder.load_bits(shown->words.data(), shown->width, shown->height, shown->wordsPerRow);
+				draw_object_overlay(window, objectFinder.get_object_cells(worldPos.x, worldPos.y));
 			}
-			window.display();
 		}
+		window.display();
 	}
+
+	sim.stop();
 }
@@ -0,0 +1,180 @@
+#ifndef SIMULATION_HPP
+#define SIMULATION_HPP
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <functional>
+
+#include "calib.hpp"
+
+using std::vector;
+
+namespace calib{
+	// A packed copy of the grid, laid out like GridView
+	struct GridSnapshot{
+		vector <wordType> words;
+		unsigned width=0, height=0, wordsPerRow=0;
+		unsigned long long generation=0;
+
+		GridView view() const {
+			GridView out;
+			out.words=words.data(); out.width=width; out.height=height; out.wordsPerRow=wordsPerRow;
+			return out;
+		}
+	};
+
+	// Lock-free triple buffer. The simulation fills the write buffer and swaps it with the latest one,
+	// the ui swaps its read buffer with the latest one. Neither side ever waits for the other
+	class SnapshotBuffer{
+		static const unsigned freshBit=4; // Set when latest hasn't been read yet
+		GridSnapshot buffers[3];
+		std::atomic <unsigned> latest;
+		unsigned writeIndex=1, readIndex=2;
+
+		public:
+
+		SnapshotBuffer() : latest(0) {}
+
+		// Snapshots are only worth making when the ui has taken the last one, so the simulation
+		// copies the grid at most once per frame instead of once per generation
+		bool wants_snapshot() const {return !(latest.load(std::memory_order_acquire) & freshBit);}
+
+		GridSnapshot &get_write_buffer(){return buffers[writeIndex];}
+		void publish(){writeIndex = latest.exchange(writeIndex | freshBit, std::memory_order_acq_rel) & ~freshBit;}
+
+		// Returns the newest snapshot, or nullptr if there hasn't been a new one since the last call
+		const GridSnapshot *get_latest(){
+			if (!(latest.load(std::memory_order_acquire) & freshBit)) return nullptr;
+			readIndex = latest.exchange(readIndex, std::memory_order_acq_rel) & ~freshBit;
+			return &buffers[readIndex];
+		}
+	};
+
+	// Steps a grid on its own thread, either as fast as possible or at a target rate, and publishes snapshots for a ui
+	// While it's running, ca must only be changed through post()
+	class SimulationThread{
+		Calib &ca;
+		std::thread thread;
+		SnapshotBuffer snapshots;
+
+		std::atomic <bool> stopRequested, paused, naive;
+		std::atomic <unsigned long long> generation, stopAtGeneration;
+		std::atomic <unsigned> targetRate; // Generations per second, 0 is as fast as possible
+
+		std::mutex editMutex;
+		vector <std::function<void(Calib&)>> edits;
+
+		bool apply_edits(){
+			vector <std::function<void(Calib&)>> newEdits;
+			{
+				std::lock_guard <std::mutex> lock(editMutex);
+				newEdits.swap(edits);
+			}
+			for (std::function<void(Calib&)> &edit : newEdits)
+				edit(ca);
+			return !newEdits.empty();
+		}
+
+		void publish(){
+			GridSnapshot &snapshot = snapshots.get_write_buffer();
+			const GridView gridView = ca.view();
+			snapshot.width = gridView.width;
+			snapshot.height = gridView.height;
+			snapshot.wordsPerRow = gridView.wordsPerRow;
+			snapshot.words.resize((unsigned long)gridView.height*gridView.wordsPerRow); // Only allocates when the grid grew
+			ca.store_bits(snapshot.words.data(), gridView.wordsPerRow);
+			snapshot.generation = generation;
+			snapshots.publish();
+		}
+
+		void loop(){
+			typedef std::chrono::steady_clock clock;
+			clock::time_point nextStep = clock::now();
+			bool unpublished=true; // The ui hasn't been sent the current grid yet
+
+			while (!stopRequested){
+				unpublished |= apply_edits();
+
+				if (paused || (generation >= stopAtGeneration)){
+					if (unpublished && snapshots.wants_snapshot()){
+						publish();
+						unpublished=false;
+					}
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+					nextStep = clock::now();
+					continue;
+				}
+
+				if (naive)
+					ca.update_naively();
+				else
+					ca.update_using_threads();
+				++generation;
+				unpublished=true;
+
+				if (snapshots.wants_snapshot()){
+					publish();
+					unpublished=false;
+				}
+
+				const unsigned rate = targetRate;
+				if (rate){
+					nextStep += std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0/rate));
+					if (nextStep < clock::now() - std::chrono::seconds(1)) // Too far behind to catch up
+						nextStep = clock::now();
+					std::this_thread::sleep_until(nextStep);
+				}
+			}
+		}
+
+		public:
+
+		SimulationThread(Calib &newCa) : ca(newCa), stopRequested(false), paused(true), naive(false), generation(0), stopAtGeneration(-1ull), targetRate(0) {}
+		~SimulationThread(){stop();}
+
+		void start(){
+			if (thread.joinable()) return;
+			stopRequested=false;
+			thread = std::thread(&SimulationThread::loop, this);
+		}
+
+		// After this ca can be used directly again
+		void stop(){
+			stopRequested=true;
+			if (thread.joinable())
+				thread.join();
+			apply_edits();
+		}
+
+		void set_paused(const bool newPaused){paused=newPaused;}
+		bool is_paused(){return paused;}
+		void set_naive(const bool newNaive){naive=newNaive;}
+		void set_target_rate(const unsigned newTargetRate){targetRate=newTargetRate;}
+		unsigned get_target_rate(){return targetRate;}
+		unsigned long long get_generation(){return generation;}
+
+		// Runs n more generations and then idles
+		void run_for(const unsigned long long n){
+			stopAtGeneration = generation + n;
+			paused = false;
+		}
+		void run_forever(){
+			stopAtGeneration = -1ull;
+			paused = false;
+		}
+		bool is_done(){return paused || (generation >= stopAtGeneration);}
+
+		// Changes the grid between two generations
+		void post(const std::function<void(Calib&)> edit){
+			std::lock_guard <std::mutex> lock(editMutex);
+			edits.push_back(edit);
+		}
+
+		const GridSnapshot *get_latest_snapshot(){return snapshots.get_latest();}
+	};
+}
+
+#endif // SIMULATION_HPP
@@ -0,0 +1,222 @@
+#ifndef TERMINAL_HPP
+#define TERMINAL_HPP
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h> // write()
+#include <sys/ioctl.h> // TIOCGWINSZ
+
+#include "calib.hpp"
+
+using std::string;
+using std::vector;
+
+namespace calib{
+	// Builds whole frames in one buffer and writes them with a single syscall
+	// When animating, only the glyphs that changed since the last frame are sent, each span behind an ANSI cursor move
+	class TerminalRenderer{
+		public:
+
+		enum Mode{
+			ascii,     // One character per cell, repeated zoomWidth times
+			halfBlock, // 1x2 cells per character
+			braille    // 2x4 cells per character
+		};
+
+		private:
+
+		Mode mode=ascii;
+		string bgChar="`", cellChar="#";
+		unsigned zoomWidth=1, zoomHeight=1;
+
+		string buffer;
+		vector <unsigned char> glyphs, shownGlyphs; // One per character cell (per cellChar repeat in ascii mode), row by row
+		unsigned rows=0, columns=0;
+		unsigned shownRows=0, shownColumns=0; // The part of the frame that fits in the terminal while animating
+		unsigned terminalColumns=0;
+		bool animating=false, hasShownFrame=false;
+
+		// Spans of changed glyphs closer than this are sent as one span, since the cursor move costs about as much
+		static const unsigned maxGap=4;
+
+		void make_glyphs(const GridView &grid){
+			const unsigned width=grid.width, height=grid.height;
+			if (mode == ascii){
+				columns = width;
+				rows    = height*zoomHeight;
+			} else if (mode == halfBlock){
+				columns = width;
+				rows    = (height+1)/2;
+			} else {
+				columns = (width+1)/2;
+				rows    = (height+3)/4;
+			}
+			glyphs.assign(rows*columns, 0);
+
+			for (unsigned row=0; row<rows; row++){
+				unsigned char *rowGlyphs = &glyphs[row*columns];
+				if (mode == ascii){
+					const unsigned y = row/zoomHeight;
+					for (unsigned x=0; x<width; x++)
+						rowGlyphs[x] = grid.get_state(x, y);
+				} else if (mode == halfBlock){
+					for (unsigned x=0; x<width; x++){
+						rowGlyphs[x] = grid.get_state(x, row*2);
+						if (row*2+1 < height) rowGlyphs[x] |= grid.get_state(x, row*2+1) << 1;
+					}
+				} else {
+					// Braille dot numbering: 1 4 / 2 5 / 3 6 / 7 8
+					static const unsigned char dotBits[4][2] = {{0x01,0x08}, {0x02,0x10}, {0x04,0x20}, {0x40,0x80}};
+					for (unsigned dy=0; dy<4 && row*4+dy < height; dy++){
+						for (unsigned x=0; x<width; x++)
+							if (grid.get_state(x, row*4+dy)) rowGlyphs[x/2] |= dotBits[dy][x&1];
+					}
+				}
+			}
+		}
+
+		void append_glyph(const unsigned char glyph){
+			if (mode == ascii){
+				const string &chr = glyph ? cellChar : bgChar;
+				for (unsigned i=0; i<zoomWidth; i++) buffer += chr;
+			} else if (mode == halfBlock){
+				static const char *const halfBlocks[4] = {" ", "▀", "▄", "█"}; // Empty, upper, lower, full
+				buffer += halfBlocks[glyph];
+			} else { // U+2800 + dots, in UTF-8
+				buffer += char(0xe2);
+				buffer += char(0xa0 | (glyph >> 6));
+				buffer += char(0x80 | (glyph & 0x3f));
+			}
+		}
+
+		void append_cursor_move(const unsigned row, const unsigned column){
+			buffer += "\033[" + to_str(row+1) + ';' + to_str(column*(mode == ascii ? zoomWidth : 1) + 1) + 'H';
+		}
+
+		void append_full_frame(){
+			for (unsigned row=0; row<rows; row++){
+				for (unsigned column=0; column<columns; column++)
+					append_glyph(glyphs[row*columns + column]);
+				buffer += '\n';
+			}
+		}
+
+		// Absolute cursor moves only work if the frame never scrolls, so it's cut down to what fits in the terminal
+		// (leaving the last line for the cursor, and one more for a note if it doesn't fit)
+		void fit_to_terminal(){
+			shownRows=rows; shownColumns=columns; terminalColumns=0;
+
+			winsize size;
+			if ((ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0) || (size.ws_row == 0) || (size.ws_col == 0)) return; // Not a terminal
+			terminalColumns = size.ws_col;
+			const unsigned glyphWidth = (mode == ascii) ? zoomWidth : 1;
+			shownColumns = std::min(columns, std::max(1u, size.ws_col / glyphWidth));
+			if ((rows >= size.ws_row) || (shownColumns < columns))
+				shownRows = std::min(rows, size.ws_row > 2 ? size.ws_row - 2u : 1u);
+		}
+
+		bool is_clipped(){return (shownRows < rows) || (shownColumns < columns);}
+
+		void append_animation_frame(){
+			buffer += "\033[2J";
+			for (unsigned row=0; row<shownRows; row++){
+				append_cursor_move(row, 0);
+				for (unsigned column=0; column<shownColumns; column++)
+					append_glyph(glyphs[row*columns + column]);
+			}
+			if (is_clipped()){
+				append_cursor_move(shownRows, 0);
+				const string note = "Showing " + to_str(shownColumns) + 'x' + to_str(shownRows) + " of " + to_str(columns) + 'x' + to_str(rows) + " characters, the terminal is too small";
+				buffer += note.substr(0, terminalColumns);
+				append_cursor_move(shownRows+1, 0);
+			} else {
+				append_cursor_move(shownRows, 0);
+			}
+		}
+
+		void append_changes(){
+			for (unsigned row=0; row<shownRows; row++){
+				const unsigned char *rowGlyphs = &glyphs[row*columns];
+				const unsigned char *shownRow  = &shownGlyphs[row*columns];
+
+				unsigned column=0;
+				while (column < shownColumns){
+					if (rowGlyphs[column] == shownRow[column]){
+						++column;
+						continue;
+					}
+
+					// Extend the span until there are maxGap unchanged glyphs in a row
+					unsigned end=column+1, lastChanged=column;
+					for (; (end < shownColumns) && (end - lastChanged <= maxGap); end++)
+						if (rowGlyphs[end] != shownRow[end]) lastChanged=end;
+
+					append_cursor_move(row, column);
+					for (unsigned i=column; i<=lastChanged; i++)
+						append_glyph(rowGlyphs[i]);
+					column = lastChanged+1;
+				}
+			}
+			append_cursor_move(shownRows + (is_clipped() ? 1 : 0), 0); // Leave the cursor under the grid (and the note)
+		}
+
+		void flush(){
+			std::cout.flush(); // Anything already printed through cout has to come first
+			const char *data = buffer.data();
+			size_t left = buffer.size();
+			while (left){
+				const ssize_t written = write(STDOUT_FILENO, data, left);
+				if (written <= 0) break;
+				data += written;
+				left -= written;
+			}
+			buffer.clear(); // Keeps its capacity for the next frame
+		}
+
+		public:
+
+		void set_mode(const Mode newMode){mode=newMode; hasShownFrame=false;}
+		Mode get_mode(){return mode;}
+		void set_chars(const string newBgChar, const string newCellChar){bgChar=newBgChar; cellChar=newCellChar; hasShownFrame=false;}
+		void set_zoom(const unsigned newZoomWidth, const unsigned newZoomHeight){zoomWidth=newZoomWidth; zoomHeight=newZoomHeight; hasShownFrame=false;}
+
+		// Prints the grid where the cursor is
+		void print(const GridView &grid){
+			make_glyphs(grid);
+			append_full_frame();
+			flush();
+		}
+
+		// Clears the screen, after which every draw() only sends what changed
+		void begin_animation(){
+			animating=true;
+			hasShownFrame=false;
+		}
+
+		void draw(const GridView &grid){
+			if (!animating){
+				print(grid);
+				return;
+			}
+
+			const unsigned oldRows=rows, oldColumns=columns, oldShownRows=shownRows, oldShownColumns=shownColumns;
+			make_glyphs(grid);
+			fit_to_terminal();
+
+			if (!hasShownFrame || (rows != oldRows) || (columns != oldColumns) || (shownRows != oldShownRows) || (shownColumns != oldShownColumns)){
+				append_animation_frame();
+				hasShownFrame=true;
+			} else {
+				append_changes();
+			}
+			glyphs.swap(shownGlyphs);
+			flush();
+		}
+
+		void end_animation(){animating=false;}
+	};
+}
+
+#endif // TERMINAL_HPP
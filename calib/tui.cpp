@@ -1,8 +1,12 @@
 #include <iostream>
 #include <string>
 #include <array>
+#include <thread>
+#include <chrono>
 
 #include "calib.hpp"
+#include "simulation.hpp"
+#include "terminal.hpp"
 
 using std::string;
 using std::array;
@@ -11,8 +15,9 @@ const string bgChar   = "`";
 const string cellChar = "#";
 const string prompt   = "\033[34m>\033[0m ";
 unsigned step=1;
-unsigned char zoomWidth=1;
-unsigned char zoomHeight=1;
+unsigned rate=0; // Generations per second for run, 0 is as fast as possible
+const unsigned framesPerSecond=30;
+calib::TerminalRenderer renderer;
 
 const char argSeparator = ' ';
 
@@ -27,26 +32,6 @@ void usage(){
 	std::cerr << "Usage: tui [number of threads]\n";
 }
 
-void print_n_times(const string str, const unsigned char n){
-	for (unsigned char i=0; i<n; i++)
-		std::cout << str;
-}
-
-void print_grid(calib::Calib &ca){
-	const array <unsigned long, 2> gridSize = ca.get_size();
-	for (unsigned y=0; y<gridSize[1]; y++){
-		for (unsigned char repeat=0; repeat<zoomHeight; repeat++){
-			for (unsigned x=0; x<gridSize[0]; x++){
-				if (ca.get_state(x,y))
-					print_n_times(cellChar,zoomWidth);
-				else
-					print_n_times(bgChar,zoomWidth);
-			}
-			std::cout << '\n';
-		}
-	}
-}
-
 string get_nth_word(const string str, const unsigned char n){
 	int lastSeparatorIdx=-1;
 	unsigned nthSeparator=0;
@@ -65,6 +50,32 @@ string get_nth_word(const string str, const unsigned char n){
 	return str;
 }
 
+// Steps on a background thread and prints the newest generation every frame, skipping the ones in between
+void run(calib::Calib &ca, const bool naive){
+	calib::SimulationThread sim(ca);
+	sim.set_naive(naive);
+	sim.set_target_rate(rate);
+	sim.start();
+	sim.run_for(step);
+
+	unsigned long long shownGeneration=0;
+	bool shownAny=false;
+	renderer.begin_animation();
+	while (!sim.is_done() || !shownAny || (shownGeneration != sim.get_generation())){
+		const calib::GridSnapshot *snapshot = sim.get_latest_snapshot();
+		if (snapshot){
+			renderer.draw(snapshot->view());
+			shownGeneration = snapshot->generation;
+			shownAny=true;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1000/framesPerSecond));
+	}
+	renderer.end_animation();
+	std::cout << "Generation " << shownGeneration << '\n';
+
+	sim.stop();
+}
+
 bool parse_and_run_cmd(const string cmd, calib::Calib &ca){
 	const string baseCommand = get_nth_word(cmd, 0);
 	const string arg1        = get_nth_word(cmd, 1);
@@ -77,7 +88,7 @@ bool parse_and_run_cmd(const string cmd, calib::Calib &ca){
 	try {arg2Num=std::stoi(arg2);} catch(std::invalid_argument){arg2Num=1; argNumError=argerror(argNumError|2);}
 
 	if (baseCommand == "show"){
-		print_grid(ca);
+		renderer.print(ca.view());
 	} else if (baseCommand == "step"){
 		if (argNumError&1){
 			for (unsigned long long i=0; i<step; i++)
@@ -99,26 +110,29 @@ bool parse_and_run_cmd(const string cmd, calib::Calib &ca){
 		ca.fill_grid_randomly();
 	} else if (baseCommand == "zoom"){
 		if (argNumError&1) return 0;
-		if (argNumError==none){
-			zoomWidth=arg1Num; zoomHeight=arg2Num;
-		} else{
-			zoomWidth=arg1Num; zoomHeight=arg1Num;
-		}
+		if (argNumError==none)
+			renderer.set_zoom(arg1Num, arg2Num);
+		else
+			renderer.set_zoom(arg1Num, arg1Num);
 	} else if (baseCommand =="resize"){
 		if (argNumError) return 0;
 		ca.set_size(arg1Num,arg2Num);
 	} else if (baseCommand == "run"){
-		for (unsigned long long i=0; i<step; i++){
-			print_grid(ca);
-			print_n_times("\n", 2);
-			ca.update_using_threads();
-		}
+		run(ca, false);
 	} else if (baseCommand == "runnaive"){
-		for (unsigned long long i=0; i<step; i++){
-			print_grid(ca);
-			print_n_times("\n", 2);
-			ca.update_naively();
-		}
+		run(ca, true);
+	} else if (baseCommand == "render"){
+		if (arg1 == "ascii")
+			renderer.set_mode(calib::TerminalRenderer::ascii);
+		else if (arg1 == "half")
+			renderer.set_mode(calib::TerminalRenderer::halfBlock);
+		else if (arg1 == "braille")
+			renderer.set_mode(calib::TerminalRenderer::braille);
+		else
+			std::cout << "Render modes are ascii, half and braille\n";
+	} else if (baseCommand == "rate"){
+		if (argNumError&1) return 0;
+		rate=arg1Num;
 	} else if (baseCommand == "help"){
 		std::cout << "Parentheses mean an optional argument, square brackets for necessary\n";
 		std::cout << "__________________________________________________\n";
@@ -132,8 +146,10 @@ bool parse_and_run_cmd(const string cmd, calib::Calib &ca){
 		std::cout << "random    |                          | Fill grid with random assortment of cells\n";
 		std::cout << "zoom      | [width] (height)         | Sets zoom level. Only a first argument will set the zoom to width*width, if both, set width and height separately\n";
 		std::cout << "resize    | [width] [height]         | Resizes the grid\n";
-		std::cout << "run       |                          | Iterates and draws repeatedly\n";
-		std::cout << "runnaive  |                          | Iterates naively and draws repeatedly\n";
+		std::cout << "run       |                          | Iterates step times in the background, drawing the newest generation " << framesPerSecond << " times a second\n";
+		std::cout << "runnaive  |                          | Same as run, but iterates using naivelife\n";
+		std::cout << "render    | [ascii/half/braille]     | How cells are drawn: a character per cell (zoomable), 1x2 cells per character, or 2x4 cells per character\n";
+		std::cout << "rate      | [generations per second] | Limits how fast run iterates, 0 is as fast as possible\n";
 	} else if (baseCommand == "q"){
 		return 1;
 	} else if (!baseCommand.empty()){
@@ -145,7 +161,6 @@ bool parse_and_run_cmd(const string cmd, calib::Calib &ca){
 
 int main(int argc, char *argv[]){
 	calib::Calib ca(30,15);
-	const array <unsigned long, 2> gridSize = ca.get_size();
 
 	// Command-line argument checking
 	unsigned numThreads;
@@ -156,14 +171,13 @@ int main(int argc, char *argv[]){
 			usage();
 			numThreads = 1;
 		}
-		if (gridSize[0] % numThreads != 0)
-			std::cout << "WARNING: Width is not divisible by number of threads. Output will be wrong\n";
 	} else {
 		usage();
 		numThreads = 1;
 	}
 
 	ca.set_num_threads(numThreads);
+	renderer.set_chars(bgChar, cellChar);
 	std::cerr << "Using " << numThreads << " thread" << (numThreads>1?"s":"") << ".\n";
 
 	bool exit=false;
@@ -0,0 +1 @@
+g++ -Wall -std=c++11 -O2 dsquery.cpp -o "dsquery"
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <iomanip>
+
+#include "resultstore.hpp"
+
+using std::string;
+using std::vector;
+
+bool printRle=false;
+
+void usage(){
+	std::cerr << "Usage: dsquery [result store] [command] (arguments) OPTIONS\n";
+	std::cerr << "\tCOMMANDS:\n";
+	std::cerr << "\tinfo                      \tShow the soup size and number of records\n";
+	std::cerr << "\tindex                     \tIndex the store by hash and lifespan (writes [result store].idx)\n";
+	std::cerr << "\tlist                      \tList every record\n";
+	std::cerr << "\thash [HASH]               \tList records with the canonical hash HASH (hexadecimal)\n";
+	std::cerr << "\tlifespan [MIN] (MAX)      \tList records with a lifespan between MIN and MAX\n";
+	std::cerr << "\tunique                    \tList the first record of every canonical hash\n";
+	std::cerr << "\tOPTIONS:\n";
+	std::cerr << "\t--rle                     \tPrint records as RLE (the same format as dsearch's text results)\n";
+}
+
+void print_record(const ResultStore &store, const uint64_t i){
+	if (printRle){
+		std::cout << store.get_rle(i);
+		return;
+	}
+
+	const RecordView record = store.get_record(i);
+	std::cout << record.header->soupId << ' ' << record.header->lifespan << ' '
+		<< std::hex << std::setw(16) << std::setfill('0') << record.header->hash << std::dec << ' '
+		<< calib::Calib::rule_to_rulestring(unpack_rule(record.header->rule)) << '\n';
+}
+
+int main(int argc, char *argv[]){
+	vector <string> args;
+	for (int i=1; i<argc; i++){
+		const string arg = argv[i];
+		if (arg == "--rle") printRle=true;
+		else args.push_back(arg);
+	}
+
+	if (args.size() < 2){
+		usage();
+		return 1;
+	}
+
+	const string filename = args[0];
+	const string command  = args[1];
+
+	ResultStore store;
+	if (!store.open(filename)){
+		std::cerr << "Could not open result store " << filename << '\n';
+		return 2;
+	}
+
+	try{
+		if (command == "info"){
+			std::cout << "Soup size: " << store.get_soup_size() << 'x' << store.get_soup_size() << '\n';
+			std::cout << "Records:   " << store.size() << '\n';
+			std::cout << "Indexed:   " << store.get_num_indexed() << '\n';
+		} else if (command == "index"){
+			if (!store.write_index(filename)){
+				std::cerr << "Could not write the index\n";
+				return 3;
+			}
+			std::cout << "Indexed " << store.size() << " records\n";
+		} else if (command == "list"){
+			for (uint64_t i=0; i<store.size(); i++)
+				print_record(store, i);
+		} else if (command == "hash"){
+			if (args.size() < 3){usage(); return 1;}
+			for (uint64_t i : store.find_hash(std::stoull(args[2], nullptr, 16)))
+				print_record(store, i);
+		} else if (command == "lifespan"){
+			if (args.size() < 3){usage(); return 1;}
+			const unsigned min = std::stoul(args[2]);
+			const unsigned max = args.size() > 3 ? std::stoul(args[3]) : min;
+			for (uint64_t i : store.find_lifespan(min, max))
+				print_record(store, i);
+		} else if (command == "unique"){
+			std::unordered_set <uint64_t> seen;
+			for (uint64_t i=0; i<store.size(); i++){
+				if (seen.insert(store.get_record(i).header->hash).second)
+					print_record(store, i);
+			}
+		} else {
+			usage();
+			return 1;
+		}
+	} catch (const std::logic_error &){ // std::stoul() failed
+		usage();
+		return 1;
+	}
+}
@@ -2,8 +2,11 @@
 #include <string>
 #include <vector>
 #include <thread>
+#include <csignal>
 
 #include "searchers.hpp"
+#include "verifier.hpp"
+#include "autotune.hpp"
 
 using std::string;
 using std::vector;
@@ -12,17 +15,47 @@ using std::array;
 bool exitSearch=false;
 bool quiet=false;
 
+string traceFilename, traceMarkersFilename;
+volatile sig_atomic_t traceDumpRequested=0; // Set by SIGUSR1, the search dumps the trace after the batch it's on
+
 void usage(){
 	std::cerr << "Usage: dsearch [iteration count] [batch size (e.g 400)] [file to store results] OPTIONS\n";
+	std::cerr << "       dsearch --verify=FILE (--quiet) (--maxgridmb=NUMBER)\n";
 	std::cerr << "\tOPTIONS:\n";
 	std::cerr << "\t--rule=STRING             \tSet rulestring (default b3/s23)\n";
 	std::cerr << "\t--percent=NUMBER          \tSet percent of alive cells in the soups\n";
 	std::cerr << "\t--soupsize=NUMBER         \tSet soup size to NUMBER x NUMBER (default 16)\n";
 	std::cerr << "\t--quiet                   \tNo output to stdout\n";
+	std::cerr << "\t--binary                  \tStore results in a binary result store (read it with dsquery)\n";
+	std::cerr << "\t--threads=NUMBER          \tSearch soups on NUMBER threads, up to 4096 (default is one thread per soup in the batch)\n";
+	std::cerr << "\t--stepthreads=NUMBER      \tStep each soup using NUMBER threads, up to 4096 (default 1)\n";
+	std::cerr << "\t--pin                     \tPin every search thread to its own cpu (with --stepthreads=N, N cpus each)\n";
+	std::cerr << "\t--cpus=LIST               \tPin search threads to the cpus in LIST (e.g 0-7,16-23), N at a time with --stepthreads=N\n";
+	std::cerr << "\t--exhaustive              \tSearch every soup (up to symmetry) instead of random ones. Batches are chunks of 65536 soups\n";
+	std::cerr << "\t--startchunk=NUMBER       \tStart the exhaustive search at chunk NUMBER, for continuing an earlier search\n";
+	std::cerr << "\t--autotune                \tBenchmark thread counts, step threads and batch sizes, and use the fastest (not the batch size with --exhaustive)\n";
+	std::cerr << "\t--retune                  \tSame as --autotune, but ignore earlier autotuning results\n";
+	std::cerr << "\t--autotune-cache=FILE     \tWhere autotuning results are kept (default ~/.dsearch_autotune)\n";
+	std::cerr << "\t--verify=FILE             \tRe-simulate every pattern in a result file and check that it still dies in time\n";
+	std::cerr << "\t--maxgridmb=NUMBER        \tWith --verify, skip patterns whose grid would need more than NUMBER MB (default 1024)\n";
+	std::cerr << "\t--trace=FILE              \tWrite a Chrome trace of the search to FILE on exit and on SIGUSR1 (needs a -DDSEARCH_TRACE build)\n";
+	std::cerr << "\t--trace-markers=FILE      \tSame, but as CLOCK_MONOTONIC timestamps for lining up with perf record -k mono\n";
+}
+
+void dump_trace(){
+	if (!traceFilename.empty() && !trace::write_chrome_json(traceFilename))
+		std::cerr << "Could not write trace to " << traceFilename << '\n';
+	if (!traceMarkersFilename.empty() && !trace::write_markers(traceMarkersFilename))
+		std::cerr << "Could not write trace markers to " << traceMarkersFilename << '\n';
 }
 
-void run_search_once(DeathSearcher &searcher, const unsigned long long i){
-	searcher.run_search_batch();
+void request_trace_dump(int){traceDumpRequested=1;}
+
+void run_search_once(DeathSearcher &searcher, const unsigned long long i, const bool exhaustive=false){
+	if (exhaustive)
+		searcher.run_exhaustive_batch();
+	else
+		searcher.run_search_batch();
 	const unsigned resultSize=searcher.get_result_size();
 	if (!quiet){
 		if (resultSize) std::cout << "\033[32m";
@@ -33,6 +66,11 @@ void run_search_once(DeathSearcher &searcher, const unsigned long long i){
 
 	if (!quiet)
 		std::cout << "Logged\033[0m\n";
+
+	if (traceDumpRequested){ // No search threads are running between batches
+		traceDumpRequested=0;
+		dump_trace();
+	}
 }
 
 void run_search(DeathSearcher &searcher, const unsigned batchSize){
@@ -51,12 +89,82 @@ void run_search(DeathSearcher &searcher, const unsigned batchSize){
 	}
 }
 
+void run_exhaustive_search(DeathSearcher &searcher){
+	for (unsigned long long i=0; !exitSearch && !searcher.exhaustive_search_done(); i++){
+		if (!quiet){
+			if (i%20==0)
+				std::cout << "\033[31mPress q + enter to quit\033[0m\n"; // Just a reminder
+		}
+
+		run_search_once(searcher, i+1, true); // Start at 1
+
+		if (!quiet){
+			std::cout << "Searched " << searcher.get_exhaustive_percent_done() << "% (next chunk " << searcher.get_exhaustive_next_chunk()
+				<< " of " << searcher.get_exhaustive_num_chunks() << ", " << searcher.get_exhaustive_soups_tested() << " canonical soups tested)\n";
+		}
+	}
+
+	if (!quiet && searcher.exhaustive_search_done())
+		std::cout << "Every soup has been searched\n";
+}
+
+void wait_for_quit(){
+	// This is just a loop for exiting the program safely
+	while (!exitSearch){
+		string input;
+		if (!std::getline(std::cin, input)) break; // stdin was closed, keep searching until the search ends by itself
+		if (input == "q") exitSearch=true;
+	}
+}
+
 bool starts_with(const string str, const string b){
 	if (b.size() > str.size()) return false;
 	return str.substr(0,b.size()) == b;
 }
 
+// For --threads and --stepthreads. Parsed as signed, since std::stoi() into an unsigned turns -1 into 4294967295 threads
+bool parse_thread_count(const string value, unsigned &out){
+	const long maxThreadCount=4096;
+	try{
+		const long count = std::stol(value);
+		if ((count < 0) || (count > maxThreadCount)) return false;
+		out = count;
+	} catch(const std::logic_error &){
+		return false;
+	}
+	return true;
+}
+
+int verify(const string filename, const unsigned maxGridMegabytes){
+	Verifier verifier(std::thread::hardware_concurrency(), quiet, maxGridMegabytes);
+	return verifier.verify_file(filename) ? 0 : 6;
+}
+
 int main(int argc, char *argv[]){
+	// --verify doesn't take the other arguments, so look for it first
+	string verifyFilename;
+	unsigned maxGridMegabytes=1024;
+	for (int i=1; i<argc; i++){
+		const string option = argv[i];
+		if (starts_with(option, "--verify=")){
+			const unsigned flagLength = string("--verify=").size();
+			verifyFilename = option.substr(flagLength, option.size()-flagLength);
+		} else if (option == "--quiet"){
+			quiet=true;
+		} else if (starts_with(option, "--maxgridmb=")){
+			const unsigned flagLength = string("--maxgridmb=").size();
+			const string value = option.substr(flagLength, option.size()-flagLength);
+			try{
+				maxGridMegabytes = std::stoul(value);
+			} catch(const std::logic_error &){
+				usage();
+				return 13;
+			}
+		}
+	}
+	if (!verifyFilename.empty())
+		return verify(verifyFilename, maxGridMegabytes);
+
 	if (argc < 4){ // Must have atleast 3 arguments
 		usage();
 		return 1;
@@ -66,6 +174,14 @@ int main(int argc, char *argv[]){
 	unsigned nIters, batchSize, soupSize=16;
 	unsigned char soupPercentAlive=50;
 	string ruleString="b3/s23";
+	bool binaryResults=false;
+	unsigned numThreads=0, stepThreads=1;
+	bool autotune=false, retune=false;
+	bool pin=false;
+	bool exhaustive=false;
+	unsigned long long startChunk=0;
+	vector <unsigned> cpus;
+	string autotuneCacheFilename=Autotuner::get_default_cache_filename();
 
 	try{
 		nIters                = std::stoi(argv[1]);
@@ -103,25 +219,155 @@ int main(int argc, char *argv[]){
 				
 			} else if (option == "--quiet"){
 				quiet=true;
+			} else if (option == "--binary"){
+				binaryResults=true;
+			} else if (starts_with(option, "--threads=")){
+				const unsigned flagLength = string("--threads=").size();
+				const string value = option.substr(flagLength, option.size()-flagLength);
+				if (!parse_thread_count(value, numThreads)){
+					usage();
+					return 7;
+				}
+			} else if (starts_with(option, "--stepthreads=")){
+				const unsigned flagLength = string("--stepthreads=").size();
+				const string value = option.substr(flagLength, option.size()-flagLength);
+				if (!parse_thread_count(value, stepThreads)){
+					usage();
+					return 8;
+				}
+			} else if (option == "--pin"){
+				pin=true;
+			} else if (starts_with(option, "--cpus=")){
+				const unsigned flagLength = string("--cpus=").size();
+				const string value = option.substr(flagLength, option.size()-flagLength);
+				if (!parse_cpu_list(value, cpus)){
+					usage();
+					return 9;
+				}
+				const vector <unsigned> availableCpus = get_available_cpus();
+				for (const unsigned cpu : cpus){
+					if (!availableCpus.empty() && (std::find(availableCpus.begin(), availableCpus.end(), cpu) == availableCpus.end())){
+						std::cerr << "Cpu " << cpu << " isn't one this process can run on\n";
+						usage();
+						return 9;
+					}
+				}
+				pin=true;
+			} else if (option == "--exhaustive"){
+				exhaustive=true;
+			} else if (starts_with(option, "--startchunk=")){
+				const unsigned flagLength = string("--startchunk=").size();
+				const string value = option.substr(flagLength, option.size()-flagLength);
+				try{
+					startChunk = std::stoull(value);
+				} catch(const std::logic_error &){
+					usage();
+					return 11;
+				}
+			} else if (option == "--autotune"){
+				autotune=true;
+			} else if (option == "--retune"){
+				autotune=true;
+				retune=true;
+			} else if (starts_with(option, "--autotune-cache=")){
+				const unsigned flagLength = string("--autotune-cache=").size();
+				autotuneCacheFilename = option.substr(flagLength, option.size()-flagLength);
+			} else if (starts_with(option, "--trace=")){
+				const unsigned flagLength = string("--trace=").size();
+				traceFilename = option.substr(flagLength, option.size()-flagLength);
+			} else if (starts_with(option, "--trace-markers=")){
+				const unsigned flagLength = string("--trace-markers=").size();
+				traceMarkersFilename = option.substr(flagLength, option.size()-flagLength);
 			}
 		}
 	}
 
 	if (soupPercentAlive>100){usage(); return 5;} // Make sure percentAliveCells is in the range 0-100
 	DeathSearcher searcher(ruleString, nIters, soupSize, batchSize, resultFilename, soupPercentAlive);
+	searcher.set_binary_results(binaryResults);
+	if (binaryResults){ // Otherwise a file that can't be used as a store would only show up as results piling up in memory
+		ResultStoreWriter store;
+		if (!store.open(resultFilename, soupSize)){
+			std::cerr << "Could not open " << resultFilename << " as a result store\n";
+			return 12;
+		}
+		store.close();
+
+		ResultStore existing;
+		if (existing.open(resultFilename))
+			searcher.set_soups_searched(existing.get_next_soup_id());
+	}
+	searcher.set_num_threads(numThreads);
+	searcher.set_step_threads(stepThreads);
+	if (pin){
+		if (cpus.empty()) cpus = get_available_cpus();
+		if (cpus.empty())
+			std::cerr << "Pinning threads isn't supported on this system, searching unpinned\n";
+		searcher.set_cpus(cpus);
+	}
+
+	if (autotune){
+		Autotuner tuner(ruleString, nIters, soupSize, batchSize, soupPercentAlive, quiet);
+		tuner.set_cpus(cpus);
+		const TuneConfig config = tuner.get_config(autotuneCacheFilename, retune);
+		searcher.set_num_threads(config.numThreads);
+		searcher.set_step_threads(config.stepThreads);
+
+		// The tuned batch size is a number of random soups, while exhaustive batches are counted in chunks of 65536 soups
+		if (!exhaustive){
+			searcher.set_batch_size(config.batchSize);
+			batchSize = config.batchSize;
+		}
+
+		if (!quiet){
+			std::cout << "Autotuned: threads=" << (config.numThreads ? to_str(config.numThreads) : "per soup")
+				<< " stepthreads=" << config.stepThreads;
+			if (!exhaustive) std::cout << " batch=" << config.batchSize;
+			std::cout << " (" << unsigned(config.soupsPerSecond) << " soups/s)\n";
+		}
+	}
+
+	// After autotuning, so its benchmarks don't fill the trace
+	if (!traceFilename.empty() || !traceMarkersFilename.empty()){
+		if (!trace::compiledIn){
+			std::cerr << "dsearch was built without tracing, build it with -DDSEARCH_TRACE to use --trace and --trace-markers\n";
+			traceFilename.clear();
+			traceMarkersFilename.clear();
+		} else {
+			trace::set_enabled(true);
+			struct sigaction action = {};
+			action.sa_handler = request_trace_dump;
+			action.sa_flags = SA_RESTART; // Don't interrupt the quit loop's getline()
+			sigaction(SIGUSR1, &action, nullptr);
+		}
+	}
+
+	if (exhaustive){
+		if (!searcher.can_search_exhaustively()){
+			std::cerr << "Exhaustive search only works with soup sizes up to 7\n";
+			return 10;
+		}
+		searcher.set_exhaustive_next_chunk(startChunk);
+
+		if (!quiet)
+			std::cout << "Running exhaustive search on rulestring " << searcher.get_rulestring() << '\n';
+
+		// The search ends by itself, so it can't wait for the quit loop
+		std::thread quitThread(wait_for_quit);
+		quitThread.detach();
+		run_exhaustive_search(searcher);
+		dump_trace();
+		return 0;
+	}
 
 	if (!quiet)
 		std::cout << "Running search on rulestring " << searcher.get_rulestring() << '\n';
 	std::thread searchThread(run_search, std::ref(searcher), batchSize);
 
-	// This is just a loop for exiting the program safely
-	while (!exitSearch){
-		string input;
-		std::getline(std::cin, input);
-		if (input == "q") exitSearch=true;
-	}
+	wait_for_quit();
 
 	// Just to be safe
 	if (searchThread.joinable())
 		searchThread.join();
+	dump_trace();
 }
@@ -0,0 +1,420 @@
+#ifndef RESULTSTORE_HPP
+#define RESULTSTORE_HPP
+
+#include <string>
+#include <vector>
+#include <array>
+#include <fstream>
+#include <algorithm> // std::sort, std::lower_bound
+#include <cstdint>
+#include <cstddef> // offsetof
+#include <cstring> // std::memcmp, std::memcpy
+#include <cstdio> // std::rename
+
+// mmap()
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "calib/calib.hpp"
+
+using std::string;
+using std::vector;
+using std::array;
+
+typedef array <unsigned, 2> Position;
+typedef vector <Position> Object;
+typedef vector <bool> ruleType;
+
+// Binary result store layout (everything is in the byte order of the machine that wrote it):
+//   StoreHeader
+//   Record 0, Record 1, ...  every record is recordSize bytes: a RecordHeader followed by the soup's cells
+//                            packed into 64 bit words (cell x,y is bit x + y*soupSize)
+// The file is only ever appended to, so a crash can at most leave a partial record at the end. Readers ignore it,
+// and the writer cuts it off before appending.
+// The header's nextSoupId is raised before records with higher IDs are appended, so a search appending to the store can
+// start its IDs there without reading every record. Version 1 stores (DSSTORE1) have a header without it and are still
+// read and appended to, their next soup ID is found by scanning.
+//
+// The index (store filename + ".idx") is an IndexHeader followed by two arrays of IndexEntry,
+// the first sorted by canonical hash, the second sorted by lifespan. It covers the first numRecords records.
+
+const char storeMagic[8]   = {'D','S','S','T','O','R','E','2'};
+const char storeMagicV1[8] = {'D','S','S','T','O','R','E','1'};
+const char indexMagic[8]   = {'D','S','I','N','D','E','X','1'};
+
+struct StoreHeader{
+	char magic[8];
+	uint32_t soupSize;
+	uint32_t recordSize; // In bytes
+	uint64_t nextSoupId; // Higher than every soup ID in the store. Not in version 1 headers
+};
+
+const size_t storeHeaderSizeV1 = offsetof(StoreHeader, nextSoupId);
+
+// The size of the header a store with this magic starts with, 0 if it isn't a store
+size_t store_header_size(const char *magic){
+	if (std::memcmp(magic, storeMagic, sizeof(storeMagic)) == 0) return sizeof(StoreHeader);
+	if (std::memcmp(magic, storeMagicV1, sizeof(storeMagicV1)) == 0) return storeHeaderSizeV1;
+	return 0;
+}
+
+struct RecordHeader{
+	uint64_t soupId;
+	uint64_t hash; // Canonical hash, the same for every rotation, reflection and translation of the soup
+	uint32_t rule; // Birth conditions in bits 0-8, survive conditions in bits 9-17
+	uint32_t lifespan;
+};
+
+struct IndexHeader{
+	char magic[8];
+	uint64_t numRecords;
+};
+
+struct IndexEntry{
+	uint64_t key;
+	uint64_t recordIndex;
+
+	bool operator<(const IndexEntry &b) const {return (key < b.key) || ((key == b.key) && (recordIndex < b.recordIndex));}
+};
+
+// Points straight into the mapped file, nothing is copied
+struct RecordView{
+	const RecordHeader *header;
+	const uint64_t *cells;
+};
+
+unsigned words_per_soup(const unsigned soupSize){return (soupSize*soupSize + 63) / 64;}
+unsigned record_size(const unsigned soupSize){return sizeof(RecordHeader) + words_per_soup(soupSize)*sizeof(uint64_t);}
+
+uint32_t pack_rule(const std::pair <ruleType,ruleType> rule){
+	uint32_t out=0;
+	for (unsigned i=0; i<rule.first.size() && i<9; i++)
+		if (rule.first[i]) out |= 1u << i;
+	for (unsigned i=0; i<rule.second.size() && i<9; i++)
+		if (rule.second[i]) out |= 1u << (i+9);
+	return out;
+}
+
+std::pair <ruleType,ruleType> unpack_rule(const uint32_t packedRule){
+	ruleType birthRule(9), surviveRule(9);
+	for (unsigned i=0; i<9; i++){
+		birthRule[i]   = (packedRule >> i) & 1;
+		surviveRule[i] = (packedRule >> (i+9)) & 1;
+	}
+	return std::make_pair(birthRule, surviveRule);
+}
+
+void pack_object(const Object &obj, const unsigned soupSize, uint64_t *words){
+	for (unsigned i=0; i<words_per_soup(soupSize); i++) words[i]=0;
+	for (const Position &pos : obj){
+		const unsigned bit = pos[0] + pos[1]*soupSize;
+		words[bit >> 6] |= uint64_t(1) << (bit & 63);
+	}
+}
+
+Object unpack_object(const uint64_t *words, const unsigned soupSize){
+	Object out;
+	for (unsigned y=0; y<soupSize; y++){
+		for (unsigned x=0; x<soupSize; x++){
+			const unsigned bit = x + y*soupSize;
+			if ((words[bit >> 6] >> (bit & 63)) & 1)
+				out.push_back({x,y});
+		}
+	}
+	return out;
+}
+
+// Picks the smallest of the 8 rotations/reflections of obj, after moving each one to the top left corner
+Object canonical_object(const Object &obj, const unsigned soupSize){
+	const unsigned last = soupSize-1;
+	Object best;
+
+	for (unsigned transform=0; transform<8; transform++){
+		Object candidate;
+		unsigned minX=soupSize, minY=soupSize;
+		for (const Position &pos : obj){
+			unsigned x = (transform&1) ? last-pos[0] : pos[0];
+			unsigned y = (transform&2) ? last-pos[1] : pos[1];
+			if (transform&4) std::swap(x,y);
+			candidate.push_back({x,y});
+			minX = std::min(minX, x);
+			minY = std::min(minY, y);
+		}
+		for (Position &pos : candidate){
+			pos[0] -= minX;
+			pos[1] -= minY;
+		}
+		std::sort(candidate.begin(), candidate.end());
+
+		if ((transform == 0) || (candidate < best))
+			best = candidate;
+	}
+	return best;
+}
+
+// FNV-1a over the canonical object's cells
+uint64_t canonical_hash(const Object &obj, const unsigned soupSize){
+	uint64_t hash = 14695981039346656037ull;
+	for (const Position &pos : canonical_object(obj, soupSize)){
+		for (unsigned coord : pos){
+			for (unsigned byte=0; byte<4; byte++){
+				hash ^= (coord >> (byte*8)) & 0xff;
+				hash *= 1099511628211ull;
+			}
+		}
+	}
+	return hash;
+}
+
+// The same text format that dsearch writes to its result file
+string result_to_rle(const Object &soup, const std::pair <ruleType,ruleType> rule, const unsigned soupSize, const unsigned lifespan){
+	return calib::Calib::object_to_rle(soup, rule, soupSize, soupSize) + "\n#Pattern found using dsearch (nIters:" + calib::to_str(lifespan) + ")\n\n"; // Empty newline separates objects in the file
+}
+
+class ResultStoreWriter{
+	std::ofstream file;
+	string filename;
+	unsigned soupSize=0;
+	size_t headerSize=0;
+	uint64_t nextSoupId=0;
+	vector <unsigned char> record;
+
+	public:
+
+	// Creates the file if it doesn't exist, otherwise checks that its soup size matches
+	bool open(const string newFilename, const unsigned newSoupSize){
+		filename = newFilename;
+		soupSize = newSoupSize;
+		record.assign(record_size(soupSize), 0);
+
+		std::ifstream existing(filename, std::ifstream::binary);
+		StoreHeader header = {};
+		existing.read(reinterpret_cast<char*>(&header), sizeof(header));
+		const size_t bytesRead = existing.gcount();
+		headerSize = (bytesRead >= sizeof(header.magic)) ? store_header_size(header.magic) : 0;
+		if (bytesRead && ((headerSize == 0) || (bytesRead < headerSize))){ // Not empty, but not a store either
+			std::cerr << filename << " is not a dsearch result store\n";
+			return false;
+		}
+		if (bytesRead){
+			nextSoupId = (headerSize == sizeof(StoreHeader)) ? header.nextSoupId : 0;
+			if (header.soupSize != soupSize){
+				std::cerr << filename << " holds " << header.soupSize << 'x' << header.soupSize << " soups, not " << soupSize << 'x' << soupSize << '\n';
+				return false;
+			}
+			if (header.recordSize != record.size()){
+				std::cerr << filename << " has " << header.recordSize << " byte records, not " << record.size() << '\n';
+				return false;
+			}
+			existing.close();
+
+			// Cut off a partial record left by a crash, otherwise every record appended after it would be misaligned
+			struct stat fileStat;
+			if (stat(filename.c_str(), &fileStat) != 0) return false;
+			const off_t wholeRecordsSize = headerSize + (fileStat.st_size - headerSize) / record.size() * record.size();
+			if ((fileStat.st_size != wholeRecordsSize) && (truncate(filename.c_str(), wholeRecordsSize) != 0)){
+				std::cerr << "Could not cut the partial record off the end of " << filename << '\n';
+				return false;
+			}
+			file.open(filename, std::ofstream::binary | std::ofstream::app);
+		} else {
+			existing.close();
+			file.open(filename, std::ofstream::binary | std::ofstream::trunc);
+			std::memcpy(header.magic, storeMagic, sizeof(storeMagic));
+			header.soupSize = soupSize;
+			header.recordSize = record.size();
+			header.nextSoupId = 0;
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			headerSize = sizeof(header);
+		}
+		return bool(file);
+	}
+
+	// Call before appending records with soup IDs below newNextSoupId, so a crash while appending can't leave the header behind
+	void reserve_soup_ids(const uint64_t newNextSoupId){
+		if ((headerSize != sizeof(StoreHeader)) || (newNextSoupId <= nextSoupId)) return; // Version 1 stores have nowhere to keep it
+		file.flush();
+		std::fstream headerFile(filename, std::fstream::binary | std::fstream::in | std::fstream::out);
+		headerFile.seekp(offsetof(StoreHeader, nextSoupId));
+		headerFile.write(reinterpret_cast<const char*>(&newNextSoupId), sizeof(newNextSoupId));
+		if (headerFile) nextSoupId = newNextSoupId;
+	}
+
+	void append(const uint64_t soupId, const std::pair <ruleType,ruleType> rule, const unsigned lifespan, const Object &soup){
+		RecordHeader *header = reinterpret_cast<RecordHeader*>(record.data());
+		header->soupId   = soupId;
+		header->hash     = canonical_hash(soup, soupSize);
+		header->rule     = pack_rule(rule);
+		header->lifespan = lifespan;
+		pack_object(soup, soupSize, reinterpret_cast<uint64_t*>(record.data() + sizeof(RecordHeader)));
+
+		file.write(reinterpret_cast<const char*>(record.data()), record.size());
+	}
+
+	void close(){file.close();}
+};
+
+// Read-only view of a store (and its index, if there is one) through mmap
+class ResultStore{
+	const unsigned char *data=nullptr;
+	size_t dataSize=0;
+	size_t headerSize=0;
+	const unsigned char *indexData=nullptr;
+	size_t indexDataSize=0;
+
+	const StoreHeader *header=nullptr;
+	uint64_t numRecords=0;
+	const IndexHeader *indexHeader=nullptr;
+
+	static const unsigned char *map_file(const string filename, size_t &size){
+		const int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd < 0) return nullptr;
+
+		struct stat fileStat;
+		if ((fstat(fd, &fileStat) != 0) || (fileStat.st_size == 0)){
+			::close(fd);
+			return nullptr;
+		}
+		size = fileStat.st_size;
+
+		void *mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd); // The mapping stays valid
+		if (mapped == MAP_FAILED) return nullptr;
+
+		madvise(mapped, size, MADV_SEQUENTIAL);
+		return static_cast<const unsigned char*>(mapped);
+	}
+
+	const IndexEntry *index_entries(const unsigned which) const {
+		return reinterpret_cast<const IndexEntry*>(indexData + sizeof(IndexHeader)) + which*indexHeader->numRecords;
+	}
+
+	// Entries with min <= key <= max from the index, then the records the index doesn't cover
+	template <class GetKey>
+	vector <uint64_t> find(const unsigned which, const uint64_t min, const uint64_t max, GetKey get_key) const {
+		vector <uint64_t> out;
+		uint64_t firstUnindexed=0;
+
+		if (indexHeader){
+			const IndexEntry *begin = index_entries(which);
+			const IndexEntry *end   = begin + indexHeader->numRecords;
+			const IndexEntry *entry = std::lower_bound(begin, end, IndexEntry{min, 0});
+			for (; (entry != end) && (entry->key <= max); ++entry)
+				out.push_back(entry->recordIndex);
+			firstUnindexed = indexHeader->numRecords;
+		}
+
+		for (uint64_t i=firstUnindexed; i<numRecords; i++){
+			const uint64_t key = get_key(*get_record(i).header);
+			if ((key >= min) && (key <= max))
+				out.push_back(i);
+		}
+		return out;
+	}
+
+	public:
+
+	ResultStore(){}
+	ResultStore(const ResultStore&) = delete;
+	ResultStore &operator=(const ResultStore&) = delete;
+	~ResultStore(){close();}
+
+	bool open(const string filename){
+		close();
+		data = map_file(filename, dataSize);
+		if (!data) return false;
+
+		header = reinterpret_cast<const StoreHeader*>(data);
+		headerSize = (dataSize >= sizeof(header->magic)) ? store_header_size(header->magic) : 0;
+		if ((headerSize == 0) || (dataSize < headerSize) || (header->recordSize != record_size(header->soupSize))){
+			close();
+			return false;
+		}
+		numRecords = (dataSize - headerSize) / header->recordSize;
+
+		// A missing or out of date index isn't an error, every query just falls back to scanning
+		indexData = map_file(filename + ".idx", indexDataSize);
+		if (indexData){
+			const IndexHeader *newIndexHeader = reinterpret_cast<const IndexHeader*>(indexData);
+			if ((indexDataSize >= sizeof(IndexHeader))
+				&& (std::memcmp(newIndexHeader->magic, indexMagic, sizeof(indexMagic)) == 0)
+				&& (newIndexHeader->numRecords <= numRecords)
+				&& (indexDataSize == sizeof(IndexHeader) + 2*newIndexHeader->numRecords*sizeof(IndexEntry)))
+				indexHeader = newIndexHeader;
+		}
+		return true;
+	}
+
+	void close(){
+		if (data) munmap(const_cast<unsigned char*>(data), dataSize);
+		if (indexData) munmap(const_cast<unsigned char*>(indexData), indexDataSize);
+		data=nullptr; indexData=nullptr; header=nullptr; indexHeader=nullptr;
+		dataSize=0; indexDataSize=0; numRecords=0; headerSize=0;
+	}
+
+	uint64_t size() const {return numRecords;}
+	unsigned get_soup_size() const {return header->soupSize;}
+	uint64_t get_num_indexed() const {return indexHeader ? indexHeader->numRecords : 0;}
+
+	// Higher than every soup ID in the store, so a search appending to it doesn't reuse IDs
+	uint64_t get_next_soup_id() const {
+		if (headerSize == sizeof(StoreHeader)) return header->nextSoupId;
+
+		// Version 1 stores don't keep it
+		uint64_t out=0;
+		for (uint64_t i=0; i<numRecords; i++)
+			out = std::max(out, get_record(i).header->soupId + 1);
+		return out;
+	}
+
+	RecordView get_record(const uint64_t i) const {
+		const unsigned char *record = data + headerSize + i*header->recordSize;
+		return {reinterpret_cast<const RecordHeader*>(record), reinterpret_cast<const uint64_t*>(record + sizeof(RecordHeader))};
+	}
+
+	Object get_object(const uint64_t i) const {return unpack_object(get_record(i).cells, header->soupSize);}
+
+	string get_rle(const uint64_t i) const {
+		const RecordView record = get_record(i);
+		return result_to_rle(unpack_object(record.cells, header->soupSize), unpack_rule(record.header->rule), header->soupSize, record.header->lifespan);
+	}
+
+	vector <uint64_t> find_hash(const uint64_t hash) const {
+		return find(0, hash, hash, [](const RecordHeader &record){return record.hash;});
+	}
+
+	vector <uint64_t> find_lifespan(const unsigned min, const unsigned max) const {
+		return find(1, min, max, [](const RecordHeader &record){return uint64_t(record.lifespan);});
+	}
+
+	// Writes the index for every record currently in the store
+	bool write_index(const string filename) const {
+		vector <IndexEntry> byHash(numRecords), byLifespan(numRecords);
+		for (uint64_t i=0; i<numRecords; i++){
+			const RecordHeader &record = *get_record(i).header;
+			byHash[i]     = {record.hash, i};
+			byLifespan[i] = {record.lifespan, i};
+		}
+		std::sort(byHash.begin(), byHash.end());
+		std::sort(byLifespan.begin(), byLifespan.end());
+
+		IndexHeader newIndexHeader;
+		std::memcpy(newIndexHeader.magic, indexMagic, sizeof(indexMagic));
+		newIndexHeader.numRecords = numRecords;
+
+		// Write to a temporary file first so readers never see a half written index
+		const string tmpFilename = filename + ".idx.tmp";
+		std::ofstream indexFile(tmpFilename, std::ofstream::binary | std::ofstream::trunc);
+		indexFile.write(reinterpret_cast<const char*>(&newIndexHeader), sizeof(newIndexHeader));
+		indexFile.write(reinterpret_cast<const char*>(byHash.data()),     byHash.size()*sizeof(IndexEntry));
+		indexFile.write(reinterpret_cast<const char*>(byLifespan.data()), byLifespan.size()*sizeof(IndexEntry));
+		indexFile.close();
+		if (!indexFile) return false;
+
+		return std::rename(tmpFilename.c_str(), (filename + ".idx").c_str()) == 0;
+	}
+};
+
+#endif // RESULTSTORE_HPP
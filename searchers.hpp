@@ -1,6 +1,7 @@
 #ifndef SEARCHERS_HPP
 #define SEARCHERS_HPP
 
+#include <iostream>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -9,8 +10,16 @@
 #include <cstdlib> // rand()
 #include <chrono>
 #include <cmath> // std::ceil()
+#include <algorithm> // std::min()
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <cstdint>
 
 #include "calib/calib.hpp"
+#include "resultstore.hpp"
+#include "affinity.hpp"
+#include "trace.hpp"
 
 using std::string;
 using std::vector;
@@ -27,12 +36,24 @@ string to_str(const T val){
 	return convert.str();
 }
 
+struct SoupResult{
+	unsigned long long soupId;
+	Object soup;
+};
+
 class DeathSearcher{
 	unsigned nIters;
 	unsigned batchSize;
 	unsigned char soupPercentAlive;
 	string resultFilename;
-	vector <Object> result;
+	bool binaryResults=false; // Append to a binary result store (see resultstore.hpp) instead of RLE text
+	vector <SoupResult> result;
+	std::mutex resultMutex;
+	unsigned long long soupsSearched=0; // Used to give every soup an ID
+	unsigned numThreads=0;  // Threads searching soups in parallel, 0 gives every soup in a batch its own thread
+	unsigned stepThreads=1; // Threads stepping each soup (Calib::update_using_threads), 1 uses Calib::update
+	vector <unsigned> cpus; // Worker i is pinned to stepThreads cpus starting at cpus[i*stepThreads % cpus.size()], empty means no pinning
+	std::atomic <bool> pinFailed{false};
 
 	// Their sizes are size*size, meaning it's just a square
 	// Easier to deal with them this way because of the dynamic resizing of the grid
@@ -43,7 +64,14 @@ class DeathSearcher{
 
 	calib::Calib caTemplate;
 
+	// Exhaustive search: soup number i of the 2^(soupSize*soupSize) soups is the bitmask i^(i>>1) (Gray code order),
+	// where cell x,y is bit x + y*soupSize. The soups are split into chunks that workers take one at a time
+	static const unsigned exhaustiveChunkBits=16;
+	unsigned long long exhaustiveNextChunk=0;
+	unsigned long long exhaustiveSoupsTested=0; // Soups that were simulated, the rest weren't canonical
+
 	Object get_random_soup(){
+		TRACE_SCOPE("get_random_soup");
 		Object out;
 		for (unsigned y=0; y<soupSize; y++){
 			for (unsigned x=0; x<soupSize; x++){
@@ -54,6 +82,107 @@ class DeathSearcher{
 		return out;
 	}
 
+	void pin_worker(const unsigned workerIndex){
+		if (cpus.empty()) return;
+
+		// The threads Calib::update_using_threads starts inherit the worker's cpus, so it gets one for each of them
+		vector <unsigned> workerCpus;
+		for (unsigned i=0; i < std::min<size_t>(stepThreads, cpus.size()); i++)
+			workerCpus.push_back(cpus[((unsigned long)workerIndex*stepThreads + i) % cpus.size()]);
+
+		if (!pin_current_thread(workerCpus) && !pinFailed.exchange(true)){ // Only reported once, workers are started every batch
+			std::cerr << "Could not pin a search thread to cpu";
+			for (const unsigned cpu : workerCpus) std::cerr << ' ' << cpu;
+			std::cerr << ", searching unpinned\n";
+		}
+	}
+
+	// Rotates/reflects a soup bitmask and moves it to the top left corner
+	uint64_t transform_soup(uint64_t soup, const unsigned transform) const {
+		const unsigned last = soupSize-1;
+		uint64_t out=0;
+		for (; soup; soup &= soup-1){
+			const unsigned bit = __builtin_ctzll(soup);
+			unsigned x = bit % soupSize, y = bit / soupSize;
+			if (transform&1) x = last-x;
+			if (transform&2) y = last-y;
+			if (transform&4) std::swap(x,y);
+			out |= uint64_t(1) << (x + y*soupSize);
+		}
+
+		const uint64_t firstRow = (uint64_t(1) << soupSize) - 1;
+		while (!(out & firstRow)) out >>= soupSize;
+		while (!(out & get_first_column_mask())) out >>= 1; // The first column is empty, so nothing wraps around to the row above
+		return out;
+	}
+
+	uint64_t get_first_column_mask() const {
+		uint64_t out=0;
+		for (unsigned y=0; y<soupSize; y++) out |= uint64_t(1) << (y*soupSize);
+		return out;
+	}
+
+	// A soup is only simulated if it touches the top and left edges (every translation of it is the same soup)
+	// and no rotation/reflection of it is a smaller bitmask
+	bool is_canonical_soup(const uint64_t soup, const uint64_t firstColumn) const {
+		const uint64_t firstRow = (uint64_t(1) << soupSize) - 1;
+		if (!(soup & firstRow) || !(soup & firstColumn)) return false;
+
+		for (unsigned transform=1; transform<8; transform++)
+			if (transform_soup(soup, transform) < soup) return false;
+		return true;
+	}
+
+	Object soup_bits_to_object(uint64_t soup) const {
+		Object out;
+		for (; soup; soup &= soup-1){
+			const unsigned bit = __builtin_ctzll(soup);
+			out.push_back({bit % soupSize, bit / soupSize});
+		}
+		return out;
+	}
+
+	void run_exhaustive_chunk(calib::Calib &ca, const unsigned long long chunk, vector <SoupResult> &workerResult, unsigned long long &soupsTested){
+		const unsigned long long start = chunk << exhaustiveChunkBits;
+		const unsigned long long end   = std::min(start + (1ull << exhaustiveChunkBits), get_exhaustive_num_soups());
+		const uint64_t firstColumn = get_first_column_mask();
+
+		uint64_t soup = start ^ (start >> 1);
+		for (unsigned long long i=start; i<end; ){
+			if (soup && is_canonical_soup(soup, firstColumn)){ // The empty soup is skipped
+				// Every row of the soup is drawn at once, straight from the bitmask
+				calib::wordType rows[8];
+				for (unsigned y=0; y<soupSize; y++)
+					rows[y] = (soup >> (y*soupSize)) & ((uint64_t(1) << soupSize) - 1);
+
+				ca = caTemplate;
+				ca.draw_bits_to_grid(rows, soupSize, soupSize, 1, get_soup_offset(), get_soup_offset());
+				if (run_soup(ca) == 0)
+					workerResult.push_back({soup, soup_bits_to_object(soup)}); // The bitmask is the soup's ID
+				++soupsTested;
+			}
+
+			// The next soup in Gray code order differs by one cell
+			if (++i < end) soup ^= uint64_t(1) << __builtin_ctzll(i);
+		}
+	}
+
+	void run_exhaustive_worker(std::atomic <unsigned long long> &nextChunk, const unsigned long long endChunk, const unsigned workerIndex){
+		TRACE_SCOPE("run_exhaustive_worker");
+		pin_worker(workerIndex);
+
+		calib::Calib ca;
+		vector <SoupResult> workerResult;
+		unsigned long long soupsTested=0;
+
+		for (unsigned long long chunk=nextChunk++; chunk<endChunk; chunk=nextChunk++)
+			run_exhaustive_chunk(ca, chunk, workerResult, soupsTested);
+
+		std::lock_guard <std::mutex> lock(resultMutex);
+		result.insert(result.end(), workerResult.begin(), workerResult.end());
+		exhaustiveSoupsTested += soupsTested;
+	}
+
 	public:
 
 	DeathSearcher(const string ruleString, const unsigned newNIters, const unsigned newSoupSize, const unsigned newBatchSize, const string newResultFilename, const unsigned newSoupPercentAlive){
@@ -78,54 +207,159 @@ class DeathSearcher{
 	void set_n_iters(const unsigned newNIters){nIters=newNIters;}
 	unsigned get_result_size(){return result.size();}
 
-	void set_batch_size(const unsigned newBatchSize){
-		batchSize=newBatchSize;
-		result.resize(batchSize);
-		result.shrink_to_fit();
+	void set_batch_size(const unsigned newBatchSize){batchSize=newBatchSize;}
+	void set_soups_searched(const unsigned long long newSoupsSearched){soupsSearched=newSoupsSearched;}
+	unsigned get_batch_size(){return batchSize;}
+	void set_num_threads(const unsigned newNumThreads){numThreads=newNumThreads;}
+	unsigned get_num_threads(){return numThreads;}
+	void set_step_threads(const unsigned newStepThreads){
+		stepThreads = newStepThreads ? newStepThreads : 1;
+		caTemplate.set_num_threads(stepThreads);
 	}
+	unsigned get_step_threads(){return stepThreads;}
+	void clear_result(){result.clear();}
+	void set_cpus(const vector <unsigned> newCpus){cpus=newCpus;}
 	void set_soup_percent_alive(const unsigned char newSoupPercentAlive){soupPercentAlive=newSoupPercentAlive;}
 	void set_result_filename(){}
+	void set_binary_results(const bool newBinaryResults){binaryResults=newBinaryResults;}
 	void set_soup_size(const unsigned newSoupSize){soupSize=newSoupSize;}
 	void set_rule(const std::pair <ruleType,ruleType> newRule){caTemplate.set_rule(newRule);}
 	string get_rulestring(){return calib::Calib::rule_to_rulestring(caTemplate.get_rule());}
 
-	void run_one_search(calib::Calib ca){
-		const Object soup = get_random_soup();
-		const unsigned soupOffset = initialGridSize/2 - soupSize/2; // To place the soup in the middle of the grid
-		ca.draw_object_to_grid(soup, soupOffset, soupOffset);
+	// Returns the population of soup after nIters generations, ca has to be a copy of caTemplate
+	unsigned simulate(const Object &soup, calib::Calib &ca) const {
+		ca.draw_object_to_grid(soup, get_soup_offset(), get_soup_offset());
+		return run_soup(ca);
+	}
+
+	unsigned get_soup_offset() const {return initialGridSize/2 - soupSize/2;} // To place the soup in the middle of the grid
 
+	// Steps a grid that has a soup drawn on it nIters times, and returns the population
+	unsigned run_soup(calib::Calib &ca) const {
+		TRACE_SCOPE("run_soup");
 		for (unsigned i=0; i<nIters-1; i++){
 			// TODO replace all this with a if (i%sizeDiff == 0) ca.add_size_all_sides(sizeDiff); or something
 			const unsigned long gridSize = ca.get_width(); // width = height
-			if (i+1 > gridSize - soupSize)
+			if (i+1 > gridSize - soupSize){
+				TRACE_SCOPE("add_size_all_sides");
 				ca.add_size_all_sides(sizeDiff);
+			}
 
-			ca.update(false);
+			step(ca, false);
 		}
 
-		if (ca.update(true) == 0) // Found result!
-			result.push_back(soup);
+		return step(ca, true);
+	}
+
+	unsigned step(calib::Calib &ca, const bool doSum) const {
+		if (stepThreads > 1) return ca.update_using_threads(doSum);
+		return ca.update(doSum);
+	}
+
+	bool dies_out(const Object &soup) const {
+		calib::Calib ca = caTemplate;
+		return simulate(soup, ca) == 0;
+	}
+
+	// ca is reused between soups so its memory stays where the worker first touched it
+	void run_one_search(calib::Calib &ca, const unsigned long long soupId, vector <SoupResult> &workerResult){
+		ca = caTemplate;
+		const Object soup = get_random_soup();
+		if (simulate(soup, ca) == 0) // Found result!
+			workerResult.push_back({soupId, soup});
+	}
+
+	// Searches soups until every soup in the batch has been taken
+	void run_search_worker(std::atomic <unsigned> &nextSoup, const unsigned workerIndex){
+		TRACE_SCOPE("run_search_worker");
+		pin_worker(workerIndex);
+
+		// Allocated after pinning, so on NUMA machines the grids and results live on this worker's node
+		calib::Calib ca;
+		vector <SoupResult> workerResult;
+
+		for (unsigned i=nextSoup++; i<batchSize; i=nextSoup++)
+			run_one_search(ca, soupsSearched+i, workerResult);
+
+		if (workerResult.empty()) return;
+		std::lock_guard <std::mutex> lock(resultMutex);
+		result.insert(result.end(), workerResult.begin(), workerResult.end());
 	}
 
 	void run_search_batch(){
-		vector <std::thread> searchThreads(batchSize);
+		std::atomic <unsigned> nextSoup(0);
+		vector <std::thread> searchThreads(numThreads ? std::min(numThreads, batchSize) : batchSize); // One thread per soup if numThreads is 0
+
+		{
+			TRACE_SCOPE("start_search_threads");
+			for (unsigned i=0; i<searchThreads.size(); i++)
+				searchThreads[i] = std::thread(&DeathSearcher::run_search_worker, this, std::ref(nextSoup), i);
+		}
 
+		TRACE_SCOPE("join_search_threads");
 		for (std::thread &thread : searchThreads)
-			thread = std::thread(&DeathSearcher::run_one_search, this, caTemplate);
+			thread.join();
+
+		soupsSearched += batchSize;
+	}
+
+	// Only works for soups with at most 63 cells (a 7x7 soup), everything else is far too many soups anyway
+	bool can_search_exhaustively(){return soupSize*soupSize < 64;}
+	unsigned long long get_exhaustive_num_soups(){return 1ull << (soupSize*soupSize);}
+	unsigned long long get_exhaustive_num_chunks(){return ((get_exhaustive_num_soups()-1) >> exhaustiveChunkBits) + 1;}
+	unsigned long long get_exhaustive_next_chunk(){return exhaustiveNextChunk;}
+	void set_exhaustive_next_chunk(const unsigned long long chunk){exhaustiveNextChunk=chunk;}
+	unsigned long long get_exhaustive_soups_tested(){return exhaustiveSoupsTested;}
+	bool exhaustive_search_done(){return exhaustiveNextChunk >= get_exhaustive_num_chunks();}
+	double get_exhaustive_percent_done(){return 100.0 * std::min(exhaustiveNextChunk, get_exhaustive_num_chunks()) / get_exhaustive_num_chunks();}
+
+	// Searches the next batchSize chunks
+	void run_exhaustive_batch(){
+		const unsigned long long endChunk = std::min(exhaustiveNextChunk + batchSize, get_exhaustive_num_chunks());
+		std::atomic <unsigned long long> nextChunk(exhaustiveNextChunk);
 
+		const unsigned long long numChunks = endChunk - exhaustiveNextChunk;
+		const unsigned workers = numThreads ? numThreads : std::max(1u, std::thread::hardware_concurrency()); // One thread per chunk would be far too many
+		vector <std::thread> searchThreads(std::min<unsigned long long>(workers, numChunks));
+
+		{
+			TRACE_SCOPE("start_search_threads");
+			for (unsigned i=0; i<searchThreads.size(); i++)
+				searchThreads[i] = std::thread(&DeathSearcher::run_exhaustive_worker, this, std::ref(nextChunk), endChunk, i);
+		}
+
+		TRACE_SCOPE("join_search_threads");
 		for (std::thread &thread : searchThreads)
 			thread.join();
+
+		exhaustiveNextChunk = endChunk;
 	}
 
 	void log_result(){
 		if (result.size() == 0) return;
+		TRACE_SCOPE("log_result");
 
-		std::ofstream resultFile(resultFilename, std::ofstream::app);
+		if (binaryResults){
+			ResultStoreWriter store;
+			if (!store.open(resultFilename, soupSize)) return; // Keep the results so they can be logged later
 
-		for (Object obj : result)
-			resultFile << calib::Calib::object_to_rle(obj, caTemplate.get_rule(), soupSize, soupSize) << "\n#Pattern found using dsearch (nIters:" << nIters << ")\n\n"; // Empty newline separates objects in the file
+			uint64_t nextSoupId=0;
+			for (const SoupResult &found : result)
+				nextSoupId = std::max<uint64_t>(nextSoupId, found.soupId+1);
+			store.reserve_soup_ids(nextSoupId);
 
-		resultFile.close();
+			for (const SoupResult &found : result)
+				store.append(found.soupId, caTemplate.get_rule(), nIters, found.soup);
+
+			store.close();
+		} else {
+			std::ofstream resultFile(resultFilename, std::ofstream::app);
+
+			for (const SoupResult &found : result)
+				resultFile << result_to_rle(found.soup, caTemplate.get_rule(), soupSize, nIters);
+
+			resultFile.close();
+		}
 		result.clear();
 	}
 };
@@ -0,0 +1,175 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <chrono>
+#include <cstdint>
+
+#include <unistd.h> // getpid()
+
+using std::string;
+using std::vector;
+
+// Scoped tracing of the search's hot paths, for looking at production runs in a trace viewer
+// Only compiled in when building with -DDSEARCH_TRACE, otherwise TRACE_SCOPE() is nothing and the dump functions do nothing
+//
+// Every thread records into its own ring buffer, so tracing never takes a lock. When a thread exits its buffer goes back
+// to a pool for the next thread (the searchers start new threads every batch), so threads that ran one after another
+// show up as one track. Dump only when no traced thread is running, e.g. between batches
+
+namespace trace{
+#ifdef DSEARCH_TRACE
+	const bool compiledIn=true;
+
+	struct Event{
+		const char *name; // Always a string literal
+		uint64_t start, end; // Nanoseconds of std::chrono::steady_clock, which is CLOCK_MONOTONIC on linux (like perf record -k mono)
+	};
+
+	uint64_t now(){return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();}
+
+	class ThreadBuffer{
+		static const unsigned capacity=1<<14; // Only the last capacity events of a track are kept
+		vector <Event> events;
+		uint64_t written=0;
+
+		public:
+
+		const unsigned track;
+
+		ThreadBuffer(const unsigned newTrack) : track(newTrack) {}
+
+		void record(const char *name, const uint64_t start, const uint64_t end){
+			if (events.empty()) events.resize(capacity); // Allocated by the thread that uses it first
+			events[written % capacity] = {name, start, end};
+			++written;
+		}
+
+		template <class F>
+		void for_each(F f) const {
+			const uint64_t first = (written > capacity) ? written - capacity : 0;
+			for (uint64_t i=first; i<written; i++)
+				f(events[i % capacity]);
+		}
+	};
+
+	class Registry{
+		std::mutex mutex;
+		vector <std::unique_ptr<ThreadBuffer>> buffers;
+		vector <ThreadBuffer*> freeBuffers;
+
+		public:
+
+		bool enabled=false;
+
+		ThreadBuffer *acquire(){
+			std::lock_guard <std::mutex> lock(mutex);
+			if (!freeBuffers.empty()){
+				ThreadBuffer *buffer = freeBuffers.back();
+				freeBuffers.pop_back();
+				return buffer;
+			}
+			buffers.emplace_back(new ThreadBuffer(buffers.size()));
+			return buffers.back().get();
+		}
+
+		void release(ThreadBuffer *buffer){
+			std::lock_guard <std::mutex> lock(mutex);
+			freeBuffers.push_back(buffer);
+		}
+
+		template <class F>
+		void for_each_buffer(F f){
+			std::lock_guard <std::mutex> lock(mutex);
+			for (const std::unique_ptr<ThreadBuffer> &buffer : buffers)
+				f(*buffer);
+		}
+	};
+
+	Registry &get_registry(){
+		static Registry registry;
+		return registry;
+	}
+
+	// Hands the thread's buffer back when the thread exits
+	struct ThreadSlot{
+		ThreadBuffer *buffer=nullptr;
+		~ThreadSlot(){if (buffer) get_registry().release(buffer);}
+	};
+
+	ThreadBuffer &get_thread_buffer(){
+		thread_local ThreadSlot slot;
+		if (!slot.buffer) slot.buffer = get_registry().acquire();
+		return *slot.buffer;
+	}
+
+	class Scope{
+		const char *name;
+		uint64_t start;
+
+		public:
+
+		Scope(const char *newName){
+			name = get_registry().enabled ? newName : nullptr;
+			if (name) start = now();
+		}
+		~Scope(){
+			if (name) get_thread_buffer().record(name, start, now());
+		}
+	};
+
+	void set_enabled(const bool newEnabled){get_registry().enabled=newEnabled;}
+
+	// Chrome trace event format, opens in chrome://tracing and ui.perfetto.dev
+	bool write_chrome_json(const string filename){
+		std::ofstream file(filename);
+		if (!file) return false;
+
+		const unsigned pid = getpid();
+		bool first=true;
+		file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+		get_registry().for_each_buffer([&](const ThreadBuffer &buffer){
+			buffer.for_each([&](const Event &event){
+				file << (first ? "\n" : ",\n") << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << buffer.track
+					<< ",\"ts\":" << event.start/1000 << '.' << event.start/100%10 << ",\"dur\":" << (event.end-event.start)/1000 << '.' << (event.end-event.start)/100%10 << '}';
+				first=false;
+			});
+		});
+		file << "\n]}\n";
+		return bool(file);
+	}
+
+	// One line per event with CLOCK_MONOTONIC nanoseconds, for lining the phases up with perf record -k mono samples
+	bool write_markers(const string filename){
+		std::ofstream file(filename);
+		if (!file) return false;
+
+		file << "# pid " << getpid() << ", CLOCK_MONOTONIC\n# start_ns end_ns track name\n";
+		get_registry().for_each_buffer([&](const ThreadBuffer &buffer){
+			buffer.for_each([&](const Event &event){
+				file << event.start << ' ' << event.end << ' ' << buffer.track << ' ' << event.name << '\n';
+			});
+		});
+		return bool(file);
+	}
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#else
+	const bool compiledIn=false;
+
+	void set_enabled(const bool){}
+	bool write_chrome_json(const string){return false;}
+	bool write_markers(const string){return false;}
+
+#define TRACE_SCOPE(name) (void)0
+#endif
+}
+
+#endif // TRACE_HPP
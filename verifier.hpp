@@ -0,0 +1,189 @@
+#ifndef VERIFIER_HPP
+#define VERIFIER_HPP
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <cstring> // std::memcmp
+#include <cmath> // std::ceil()
+
+#include "searchers.hpp"
+#include "resultstore.hpp"
+
+using std::string;
+using std::vector;
+
+struct StoredPattern{
+	unsigned long long number; // Position in the file, starting at 1
+	string ruleString;
+	unsigned soupSize;
+	unsigned lifespan;
+	Object soup;
+};
+
+// Re-simulates every pattern in a result file (RLE text or binary store) and checks that it's dead after its recorded lifespan
+class Verifier{
+	unsigned numThreads;
+	bool quiet;
+	unsigned long long numChecked=0, numFailed=0, numUnreadable=0, numTooLarge=0;
+	unsigned maxGridMegabytes;
+
+	// One searcher per rule/soup size/lifespan, so patterns are simulated exactly like they were when they were found
+	std::map <string, std::unique_ptr<DeathSearcher>> searchers;
+	vector <StoredPattern> batch;
+	vector <DeathSearcher*> batchSearchers;
+	const unsigned maxBatchSize=16384;
+
+	// The grid grows by about one cell on each side every generation, and update() keeps two copies of it
+	bool fits_in_memory(const unsigned lifespan, const unsigned soupSize){
+		const double gridSize = double(soupSize) + 2.0*lifespan;
+		const double gridBytes = 2.0 * gridSize * std::ceil(gridSize/64) * 8;
+		return gridBytes <= maxGridMegabytes * 1048576.0;
+	}
+
+	// Returns false (and counts the pattern) if simulating it would need a grid bigger than maxGridMegabytes
+	bool check_size(const unsigned long long number, const unsigned lifespan, const unsigned soupSize){
+		if (fits_in_memory(lifespan, soupSize)) return true;
+		std::cerr << "Pattern " << number << " (" << soupSize << 'x' << soupSize << ", " << lifespan
+			<< " generations) is too large to simulate in " << maxGridMegabytes << " MB, skipping it\n";
+		++numTooLarge;
+		return false;
+	}
+
+	DeathSearcher *get_searcher(const StoredPattern &pattern){
+		const string key = pattern.ruleString + ' ' + to_str(pattern.soupSize) + ' ' + to_str(pattern.lifespan);
+		std::unique_ptr<DeathSearcher> &searcher = searchers[key];
+		if (!searcher)
+			searcher.reset(new DeathSearcher(pattern.ruleString, pattern.lifespan, pattern.soupSize, 0, "", 0));
+		return searcher.get();
+	}
+
+	void add(const StoredPattern &pattern){
+		batch.push_back(pattern);
+		batchSearchers.push_back(get_searcher(pattern));
+		if (batch.size() >= maxBatchSize)
+			verify_batch();
+	}
+
+	void verify_batch(){
+		vector <char> passed(batch.size(), 0);
+		std::atomic <size_t> nextPattern(0);
+
+		auto worker = [&](){
+			for (size_t i=nextPattern++; i<batch.size(); i=nextPattern++)
+				passed[i] = batchSearchers[i]->dies_out(batch[i].soup);
+		};
+
+		vector <std::thread> threads(std::min<size_t>(numThreads, batch.size()));
+		for (std::thread &thread : threads)
+			thread = std::thread(worker);
+		for (std::thread &thread : threads)
+			thread.join();
+
+		for (size_t i=0; i<batch.size(); i++){
+			if (passed[i]) continue;
+			++numFailed;
+			std::cout << "\033[31mPattern " << batch[i].number << " is still alive after " << batch[i].lifespan << " generations\033[0m\n";
+		}
+
+		numChecked += batch.size();
+		if (!quiet)
+			std::cout << "Verified " << numChecked << " patterns\n";
+		batch.clear();
+		batchSearchers.clear();
+	}
+
+	void read_store(const string filename){
+		ResultStore store;
+		if (!store.open(filename)){
+			std::cerr << "Could not open result store " << filename << '\n';
+			++numUnreadable;
+			return;
+		}
+
+		for (uint64_t i=0; i<store.size(); i++){
+			const RecordView record = store.get_record(i);
+			if ((record.header->rule >> 18) || (record.header->lifespan == 0) || (store.get_soup_size() == 0)){ // Only bits 0-17 hold the rule
+				std::cerr << "Record " << i+1 << " has an impossible rule, lifespan or soup size, skipping it\n";
+				++numUnreadable;
+				continue;
+			}
+			if (!check_size(i+1, record.header->lifespan, store.get_soup_size())) continue;
+			add({i+1, calib::Calib::rule_to_rulestring(unpack_rule(record.header->rule)), store.get_soup_size(), record.header->lifespan, store.get_object(i)});
+		}
+	}
+
+	void read_rle(const string filename){
+		std::ifstream file(filename);
+		calib::RleReader reader(file);
+		calib::RlePattern pattern;
+
+		for (unsigned long long number=1; reader.next(pattern); number++){
+			// The lifespan is in the comment dsearch writes after every pattern
+			unsigned lifespan=0;
+			for (const string &comment : pattern.comments){
+				const size_t pos = comment.find("nIters:");
+				if (pos != string::npos)
+					lifespan = std::strtoul(comment.c_str() + pos + string("nIters:").size(), nullptr, 10);
+			}
+
+			const unsigned soupSize = std::max(pattern.width, pattern.height);
+			bool fits = (lifespan > 0) && (pattern.width > 0) && (pattern.height > 0);
+			for (const Position &pos : pattern.cells)
+				fits = fits && (pos[0] < soupSize) && (pos[1] < soupSize);
+
+			if (!fits){
+				std::cerr << "Pattern " << number << " has no lifespan or size, or doesn't fit in its header's size, skipping it\n";
+				++numUnreadable;
+				continue;
+			}
+			if (!check_size(number, lifespan, soupSize)) continue;
+
+			add({number, pattern.rule.empty() ? "b3/s23" : pattern.rule, soupSize, lifespan, pattern.cells});
+		}
+	}
+
+	public:
+
+	// maxGridMegabytes is per simulated pattern, and numThreads patterns are simulated at once
+	Verifier(const unsigned newNumThreads, const bool newQuiet, const unsigned newMaxGridMegabytes){
+		numThreads = newNumThreads ? newNumThreads : 1;
+		quiet = newQuiet;
+		maxGridMegabytes = newMaxGridMegabytes;
+	}
+
+	// Returns true if every pattern was read, simulated and died in time
+	bool verify_file(const string filename){
+		std::ifstream file(filename, std::ifstream::binary);
+		if (!file){
+			std::cerr << "Could not open " << filename << '\n';
+			return false;
+		}
+
+		char magic[sizeof(storeMagic)] = {};
+		file.read(magic, sizeof(magic));
+		file.close();
+
+		if (store_header_size(magic))
+			read_store(filename);
+		else
+			read_rle(filename);
+
+		if (!batch.empty())
+			verify_batch();
+
+		std::cout << "Checked " << numChecked << " patterns: " << numChecked-numFailed << " passed, " << numFailed << " failed";
+		if (numUnreadable) std::cout << ", " << numUnreadable << " could not be read";
+		if (numTooLarge) std::cout << ", " << numTooLarge << " too large to simulate (see --maxgridmb)";
+		std::cout << '\n';
+
+		return (numFailed == 0) && (numUnreadable == 0) && (numTooLarge == 0);
+	}
+};
+
+#endif // VERIFIER_HPP